@@ -1,21 +1,857 @@
+#define _GNU_SOURCE // preadv()/pwritev(), MAP_POPULATE
+#include "disk.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
 
-#define BLOCK_SIZE 1024  // Size of each block in bytes
-#define BLOCK_COUNT 1024 // Total number of blocks on the disk
+// The io_uring backend talks to the kernel through raw system calls, so it
+// only needs the kernel UAPI header, not liburing.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define DISK_HAVE_IO_URING 1
+#endif
+#endif
 
 static FILE *disk_file = NULL; // File pointer for the simulated disk
+static int disk_fd = -1;       // File descriptor for the pread/pwrite backend
+static int disk_direct = 0;    // Non-zero if disk_fd was opened with O_DIRECT
 
-// Opens the disk file at the specified path in read/write binary mode.
+static unsigned char *disk_map = NULL; // Mapping of the whole image (mmap backend)
+static size_t disk_map_size = 0;       // Length of disk_map in bytes
+
+static uint32_t block_size = DEFAULT_BLOCK_SIZE; // Current block size in bytes
+static uint32_t block_count = 0;                 // Current number of blocks on the disk
+static off_t image_size = 0;                     // Size of the image file in bytes
+
+// One slot of the write-back block cache.
+typedef struct {
+    int block_num;   // Cached block number, or -1 if the slot is empty
+    int dirty;       // Non-zero if the cached copy is newer than the disk
+    int referenced;  // CLOCK reference bit, set on every access
+    int busy;        // Non-zero while the slot is read or written without disk_lock
+    int hash_next;   // Next slot in the same hash chain, or -1
+    unsigned char *data; // block_size bytes inside cache_arena
+} CacheEntry;
+
+#define CACHE_HASH_SIZE (DISK_CACHE_BLOCKS * 2) // Number of hash chains
+
+static CacheEntry cache[DISK_CACHE_BLOCKS];
+static unsigned char *cache_arena = NULL; // Backing storage for all cache slots
+static int cache_hash[CACHE_HASH_SIZE];   // Head slot of each hash chain, or -1
+static int clock_hand = 0;                // Next slot the CLOCK sweep looks at
+static DiskCacheStats cache_stats;
+
+// Guards the cache, its counters and the busy flags. Disk I/O runs without
+// it, so one thread's cache miss does not hold up another thread's hits or
+// misses. Lock order is disk_lock, then ring_lock, then stdio_lock.
+static pthread_mutex_t disk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cache_idle = PTHREAD_COND_INITIALIZER; // Signalled when a slot stops being busy
+
+// Guards the request table and the io_uring rings.
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Serializes the stdio backend's shared file position.
+static pthread_mutex_t stdio_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Reads exactly len bytes at offset with pread(), retrying short reads.
+static int fd_read_full(void *buf, size_t len, off_t offset) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = pread(disk_fd, p, len, offset);
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+// Writes exactly len bytes at offset with pwrite(), retrying short writes.
+static int fd_write_full(const void *buf, size_t len, off_t offset) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(disk_fd, p, len, offset);
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+// Reads a block straight from the disk file, bypassing the cache.
+static int raw_read(int block_num, void *buf) {
+    off_t offset = (off_t)block_num * block_size;
+    if (disk_fd >= 0) return fd_read_full(buf, block_size, offset);
+    pthread_mutex_lock(&stdio_lock);
+    fseeko(disk_file, offset, SEEK_SET); // Move file pointer to the start of the block
+    int result = fread(buf, 1, block_size, disk_file) == block_size ? 0 : -1; // Read the block and check for success
+    pthread_mutex_unlock(&stdio_lock);
+    return result;
+}
+
+// Writes a block straight to the disk file, bypassing the cache.
+static int raw_write(int block_num, const void *buf) {
+    off_t offset = (off_t)block_num * block_size;
+    if (disk_fd >= 0) return fd_write_full(buf, block_size, offset);
+    pthread_mutex_lock(&stdio_lock);
+    fseeko(disk_file, offset, SEEK_SET); // Move file pointer to the start of the block
+    int result = fwrite(buf, 1, block_size, disk_file) == block_size ? 0 : -1; // Write the block and check for success
+    pthread_mutex_unlock(&stdio_lock);
+    return result;
+}
+
+// Completes an iovec transfer at offset of which the first done bytes have
+// already been moved, e.g. after a short preadv()/pwritev().
+static int fd_finish_iov(int is_write, const struct iovec *iov, int iovcnt, off_t offset, size_t done) {
+    for (int i = 0; i < iovcnt; i++) {
+        if (done >= iov[i].iov_len) {
+            done -= iov[i].iov_len;
+            offset += (off_t)iov[i].iov_len;
+            continue;
+        }
+        char *base = (char *)iov[i].iov_base + done;
+        size_t len = iov[i].iov_len - done;
+        int result = is_write ? fd_write_full(base, len, offset + (off_t)done)
+                              : fd_read_full(base, len, offset + (off_t)done);
+        if (result != 0) return -1;
+        offset += (off_t)iov[i].iov_len;
+        done = 0;
+    }
+    return 0;
+}
+
+// Transfers a run of consecutive blocks starting at vec[0].block_num to or from
+// the buffers of vec[0..count-1], using one preadv()/pwritev() or one seek.
+static int raw_run(int is_write, const DiskIoVec *vec, int count) {
+    off_t offset = (off_t)vec[0].block_num * block_size;
+
+    if (disk_fd >= 0) {
+        struct iovec iov[DISK_MAX_RUN];
+        for (int i = 0; i < count; i++) {
+            iov[i].iov_base = vec[i].buf;
+            iov[i].iov_len = block_size;
+        }
+        ssize_t n = is_write ? pwritev(disk_fd, iov, count, offset) : preadv(disk_fd, iov, count, offset);
+        if (n < 0) return -1;
+        return fd_finish_iov(is_write, iov, count, offset, (size_t)n);
+    }
+
+    int result = 0;
+    pthread_mutex_lock(&stdio_lock);
+    fseeko(disk_file, offset, SEEK_SET); // One seek for the whole run
+    for (int i = 0; i < count && result == 0; i++) {
+        size_t n = is_write ? fwrite(vec[i].buf, 1, block_size, disk_file)
+                            : fread(vec[i].buf, 1, block_size, disk_file);
+        if (n != block_size) result = -1;
+    }
+    pthread_mutex_unlock(&stdio_lock);
+    return result;
+}
+
+// Returns the length of the run of consecutive block numbers starting at vec[0],
+// capped at DISK_MAX_RUN.
+static int run_length(const DiskIoVec *vec, int count) {
+    int n = 1;
+    while (n < count && n < DISK_MAX_RUN && vec[n].block_num == vec[n - 1].block_num + 1) n++;
+    return n;
+}
+
+// --- Asynchronous requests and the io_uring backend ---
+
+// States of an entry in the request table.
+#define REQ_FREE     0 // Slot is unused
+#define REQ_QUEUED   1 // Queued by disk_queue_read/write, not yet submitted
+#define REQ_INFLIGHT 2 // Submitted to the kernel, completion pending
+#define REQ_DONE     3 // Finished; result is valid
+
+// One block I/O request, either queued by a caller or issued internally
+// while draining a vectored transfer.
+typedef struct {
+    int state;
+    int internal;       // Non-zero for requests issued by io_vec()
+    int is_write;
+    int block_num;      // First block of the transfer
+    struct iovec single; // iovec storage for one-block requests
+    const struct iovec *iov;
+    int iovcnt;
+    size_t expected;    // Number of bytes the transfer should move
+    int result;         // 0 on success, -1 on failure, once REQ_DONE
+    DiskCallback callback;
+    void *arg;
+} DiskRequest;
+
+static DiskRequest requests[DISK_QUEUE_DEPTH];
+
+// Returns a free request slot, or -1 if the table is full.
+static int req_alloc(void) {
+    for (int i = 0; i < DISK_QUEUE_DEPTH; i++) {
+        if (requests[i].state == REQ_FREE) {
+            memset(&requests[i], 0, sizeof(requests[i]));
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Performs a request synchronously with the file descriptor or stdio backend.
+static void req_execute_sync(DiskRequest *req) {
+    if (disk_fd >= 0) {
+        req->result = fd_finish_iov(req->is_write, req->iov, req->iovcnt,
+                                    (off_t)req->block_num * block_size, 0);
+    } else {
+        DiskIoVec vec = { req->block_num, req->iov[0].iov_base };
+        req->result = raw_run(req->is_write, &vec, 1);
+    }
+    req->state = REQ_DONE;
+}
+
+#ifdef DISK_HAVE_IO_URING
+
+// Shared submission and completion rings of an io_uring instance.
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+} Ring;
+
+static Ring ring = { .fd = -1 };
+
+// Releases the io_uring instance, if any.
+static void ring_teardown(void) {
+    if (ring.fd < 0) return;
+    if (ring.sqes) munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_ring && ring.cq_ring != ring.sq_ring) munmap(ring.cq_ring, ring.cq_ring_size);
+    if (ring.sq_ring) munmap(ring.sq_ring, ring.sq_ring_size);
+    close(ring.fd);
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+// Creates an io_uring instance and maps its rings.
+// Returns 0 on success, -1 if io_uring is unavailable.
+static int ring_setup(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int)syscall(__NR_io_uring_setup, DISK_QUEUE_DEPTH, &params);
+    if (fd < 0) return -1;
+
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = fd;
+    ring.entries = params.sq_entries;
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        if (ring.cq_ring_size > ring.sq_ring_size) ring.sq_ring_size = ring.cq_ring_size;
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) {
+        ring.sq_ring = NULL;
+        ring_teardown();
+        return -1;
+    }
+
+    ring.cq_ring = single_mmap ? ring.sq_ring
+                               : mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring.cq_ring == MAP_FAILED) {
+        ring.cq_ring = NULL;
+        ring_teardown();
+        return -1;
+    }
+
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        ring.sqes = NULL;
+        ring_teardown();
+        return -1;
+    }
+
+    char *sq = ring.sq_ring;
+    char *cq = ring.cq_ring;
+    ring.sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+// Places a request in the submission ring. It is not seen by the kernel until
+// ring_enter(). Returns 0 on success, -1 if the ring is full.
+static int ring_push(int idx) {
+    DiskRequest *req = &requests[idx];
+    unsigned tail = *ring.sq_tail;
+    unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= ring.entries) return -1;
+
+    unsigned index = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = req->is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = disk_fd;
+    sqe->off = (unsigned long long)req->block_num * block_size;
+    sqe->addr = (unsigned long long)(uintptr_t)req->iov;
+    sqe->len = (unsigned)req->iovcnt;
+    sqe->user_data = (unsigned long long)idx;
+    ring.sq_array[index] = index;
+
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    req->state = REQ_INFLIGHT;
+    return 0;
+}
+
+// Submits to_submit entries and optionally waits for min_complete completions.
+static int ring_enter(unsigned to_submit, unsigned min_complete) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+        long r = syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, NULL, 0);
+        if (r >= 0) return 0;
+        if (errno != EINTR) return -1;
+    }
+}
+
+// Takes back the entries of the submission ring that the kernel has not
+// consumed, after ring_enter() failed, and fails their requests.
+static void ring_unpush(void) {
+    unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring.sq_tail;
+    for (unsigned t = head; t != tail; t++) {
+        DiskRequest *req = &requests[ring.sqes[ring.sq_array[t & *ring.sq_mask]].user_data];
+        req->result = -1;
+        req->state = REQ_DONE;
+    }
+    __atomic_store_n(ring.sq_tail, head, __ATOMIC_RELEASE);
+}
+
+// Moves every available completion into its request slot.
+// Returns the number of completions reaped.
+static int ring_reap(void) {
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    int reaped = 0;
+
+    for (; head != tail; head++, reaped++) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        DiskRequest *req = &requests[cqe->user_data];
+        if (cqe->res < 0) {
+            req->result = -1;
+        } else if ((size_t)cqe->res < req->expected) {
+            // Short transfer: finish the remainder synchronously
+            req->result = fd_finish_iov(req->is_write, req->iov, req->iovcnt,
+                                        (off_t)req->block_num * block_size, (size_t)cqe->res);
+        } else {
+            req->result = 0;
+        }
+        req->state = REQ_DONE;
+    }
+
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+// Issues every run of vec through the ring, keeping as many runs in flight as
+// the ring allows, and waits for all of them. Caller must hold ring_lock.
+static int ring_io_vec(int is_write, const DiskIoVec *vec, size_t count) {
+    struct iovec *iov = malloc(count * sizeof(*iov));
+    if (!iov) return -1;
+    for (size_t i = 0; i < count; i++) {
+        iov[i].iov_base = vec[i].buf;
+        iov[i].iov_len = block_size;
+    }
+
+    int result = 0;
+    int failed = 0; // Set once the ring fails; only in-flight runs are waited for
+    size_t next = 0;
+    int outstanding = 0;
+    while ((next < count && !failed) || outstanding > 0) {
+        unsigned pushed = 0;
+        while (next < count && !failed) {
+            int idx = req_alloc();
+            if (idx < 0) break;
+            int n = run_length(vec + next, (int)(count - next));
+            DiskRequest *req = &requests[idx];
+            req->internal = 1;
+            req->is_write = is_write;
+            req->block_num = vec[next].block_num;
+            req->iov = iov + next;
+            req->iovcnt = n;
+            req->expected = (size_t)n * block_size;
+            if (ring_push(idx) != 0) break; // Ring full; slot stays free
+            pushed++;
+            outstanding++;
+            next += (size_t)n;
+        }
+
+        if (pushed == 0 && outstanding == 0) {
+            // No request slot or ring entry available: finish synchronously
+            for (; next < count && result == 0;) {
+                int n = run_length(vec + next, (int)(count - next));
+                result = raw_run(is_write, vec + next, n);
+                next += (size_t)n;
+            }
+            break;
+        }
+
+        if (ring_enter(pushed, 1) != 0) {
+            // Entries the kernel never took fail now. The ones it took still
+            // point into iov, so they are waited for; if even that fails, iov
+            // and their slots must stay reserved.
+            ring_unpush();
+            if (failed) return -1;
+            failed = 1;
+            result = -1;
+        }
+        ring_reap();
+
+        for (int i = 0; i < DISK_QUEUE_DEPTH; i++) {
+            if (requests[i].internal && requests[i].state == REQ_DONE) {
+                if (requests[i].result != 0) result = -1;
+                requests[i].state = REQ_FREE;
+                requests[i].internal = 0;
+                outstanding--;
+            }
+        }
+    }
+
+    free(iov);
+    return result;
+}
+
+#else
+
+static struct { int fd; } ring = { -1 };
+static int ring_setup(void) { return -1; }
+static void ring_teardown(void) {}
+static int ring_push(int idx) { (void)idx; return -1; }
+static int ring_enter(unsigned to_submit, unsigned min_complete) { (void)to_submit; (void)min_complete; return -1; }
+static void ring_unpush(void) {}
+static int ring_reap(void) { return 0; }
+static int ring_io_vec(int is_write, const DiskIoVec *vec, size_t count) { (void)is_write; (void)vec; (void)count; return -1; }
+
+#endif
+
+// Returns non-zero if p meets the O_DIRECT alignment rule: block offsets are
+// multiples of block_size, so buffers are held to the same boundary.
+static int is_aligned(const void *p) {
+    return ((uintptr_t)p & (block_size - 1)) == 0;
+}
+
+// Returns non-zero if every buffer in vec is suitably aligned for O_DIRECT.
+static int vec_aligned(const DiskIoVec *vec, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!is_aligned(vec[i].buf)) return 0;
+    }
+    return 1;
+}
+
+static int io_vec(int is_write, const DiskIoVec *vec, int count);
+
+// Performs io_vec() through an aligned bounce buffer for callers whose buffers
+// cannot be handed to O_DIRECT as they are.
+static int io_vec_bounced(int is_write, const DiskIoVec *vec, int count) {
+    void *bounce = NULL;
+    DiskIoVec *aligned = malloc((size_t)count * sizeof(*aligned));
+    if (!aligned || posix_memalign(&bounce, DISK_ALIGN, (size_t)count * block_size) != 0) {
+        free(aligned);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        aligned[i].block_num = vec[i].block_num;
+        aligned[i].buf = (char *)bounce + (size_t)i * block_size;
+        if (is_write) memcpy(aligned[i].buf, vec[i].buf, block_size);
+    }
+
+    int result = io_vec(is_write, aligned, count);
+    for (int i = 0; i < count && result == 0 && !is_write; i++) {
+        memcpy(vec[i].buf, aligned[i].buf, block_size);
+    }
+
+    free(bounce);
+    free(aligned);
+    return result;
+}
+
+// Transfers every block in vec, one backend call per run of consecutive block
+// numbers. With io_uring all runs are in flight together; otherwise they are
+// issued one after another. Called without disk_lock.
+static int io_vec(int is_write, const DiskIoVec *vec, int count) {
+    if (count <= 0) return 0;
+    if (disk_direct && !vec_aligned(vec, count)) return io_vec_bounced(is_write, vec, count);
+    if (ring.fd >= 0) {
+        pthread_mutex_lock(&ring_lock);
+        int result = ring_io_vec(is_write, vec, (size_t)count);
+        pthread_mutex_unlock(&ring_lock);
+        return result;
+    }
+
+    for (int i = 0; i < count;) {
+        int n = run_length(vec + i, count - i);
+        if (raw_run(is_write, vec + i, n) != 0) return -1;
+        i += n;
+    }
+    return 0;
+}
+
+// Empties the cache and resets its counters.
+static void cache_reset(void) {
+    for (int i = 0; i < DISK_CACHE_BLOCKS; i++) {
+        cache[i].block_num = -1;
+        cache[i].dirty = 0;
+        cache[i].referenced = 0;
+        cache[i].busy = 0;
+        cache[i].hash_next = -1;
+        cache[i].data = cache_arena ? cache_arena + (size_t)i * block_size : NULL;
+    }
+    for (int i = 0; i < CACHE_HASH_SIZE; i++) cache_hash[i] = -1;
+    clock_hand = 0;
+    memset(&cache_stats, 0, sizeof(cache_stats));
+}
+
+// (Re)allocates cache storage for the current block size and empties the cache.
+// Returns 0 on success, -1 on allocation failure.
+static int cache_setup(void) {
+    // Aligned so every slot can be the target of an O_DIRECT transfer
+    free(cache_arena);
+    cache_arena = NULL;
+    void *arena;
+    if (posix_memalign(&arena, DISK_ALIGN, (size_t)DISK_CACHE_BLOCKS * block_size) == 0) cache_arena = arena;
+    cache_reset();
+    return cache_arena ? 0 : -1;
+}
+
+// Returns the slot holding block_num, or -1 if it is not cached.
+static int cache_lookup(int block_num) {
+    for (int i = cache_hash[block_num % CACHE_HASH_SIZE]; i != -1; i = cache[i].hash_next) {
+        if (cache[i].block_num == block_num) return i;
+    }
+    return -1;
+}
+
+// Removes a slot from its hash chain.
+static void cache_unhash(int slot) {
+    int *link = &cache_hash[cache[slot].block_num % CACHE_HASH_SIZE];
+    while (*link != slot) link = &cache[*link].hash_next;
+    *link = cache[slot].hash_next;
+    cache[slot].hash_next = -1;
+}
+
+// Returns the slot holding block_num once no other thread has I/O in flight on
+// it, or -1 if the block is not cached. Caller must hold disk_lock, which is
+// dropped while waiting.
+static int cache_lookup_idle(int block_num) {
+    for (;;) {
+        int slot = cache_lookup(block_num);
+        if (slot == -1 || !cache[slot].busy) return slot;
+        pthread_cond_wait(&cache_idle, &disk_lock);
+    }
+}
+
+// Clears the busy flag of a slot and wakes the threads waiting for it.
+static void cache_unbusy(int slot) {
+    cache[slot].busy = 0;
+    pthread_cond_broadcast(&cache_idle);
+}
+
+// Waits until no slot has I/O in flight. Caller must hold disk_lock.
+static void cache_wait_idle(void) {
+    for (int i = 0; i < DISK_CACHE_BLOCKS; i++) {
+        if (cache[i].busy) {
+            pthread_cond_wait(&cache_idle, &disk_lock);
+            i = -1; // The lock was dropped, so check every slot again
+        }
+    }
+}
+
+// Writes a dirty slot back to the disk and marks it clean. The slot is busy
+// and disk_lock is dropped for the write. Caller must hold disk_lock.
+static int cache_writeback(int slot) {
+    if (!cache[slot].dirty) return 0;
+    int block_num = cache[slot].block_num;
+    cache[slot].busy = 1;
+    pthread_mutex_unlock(&disk_lock);
+    int result = raw_write(block_num, cache[slot].data);
+    pthread_mutex_lock(&disk_lock);
+    cache_unbusy(slot);
+    if (result != 0) return -1;
+    cache[slot].dirty = 0;
+    cache_stats.writebacks++;
+    return 0;
+}
+
+// Orders scatter list entries by block number.
+static int compare_vec(const void *a, const void *b) {
+    const DiskIoVec *x = a, *y = b;
+    return (x->block_num > y->block_num) - (x->block_num < y->block_num);
+}
+
+// Writes back every dirty slot. The dirty blocks are sorted so neighbours go
+// out as one run, and all runs are issued together. The slots stay busy while
+// disk_lock is dropped for the I/O, and on return no slot has I/O in flight.
+// Caller must hold disk_lock.
+static int cache_writeback_all(void) {
+    DiskIoVec vec[DISK_CACHE_BLOCKS];
+    int count = 0;
+    for (int i = 0; i < DISK_CACHE_BLOCKS; i++) {
+        if (cache[i].block_num != -1 && cache[i].dirty && !cache[i].busy) {
+            vec[count].block_num = cache[i].block_num;
+            vec[count].buf = cache[i].data;
+            cache[i].busy = 1;
+            count++;
+        }
+    }
+    qsort(vec, (size_t)count, sizeof(vec[0]), compare_vec);
+
+    pthread_mutex_unlock(&disk_lock);
+    int result = io_vec(1, vec, count);
+    pthread_mutex_lock(&disk_lock);
+    for (int i = 0; i < count; i++) {
+        int slot = (int)(((unsigned char *)vec[i].buf - cache_arena) / block_size);
+        if (result == 0) {
+            cache[slot].dirty = 0;
+            cache_stats.writebacks++;
+        }
+        cache_unbusy(slot);
+    }
+    cache_wait_idle(); // Write-backs other threads started must land too
+    return result;
+}
+
+// Picks a slot to reuse with the CLOCK algorithm, skipping busy slots.
+// Returns the slot index, or -1 if every slot is busy.
+static int cache_victim(void) {
+    for (int n = 0; n < 2 * DISK_CACHE_BLOCKS; n++) {
+        int slot = clock_hand;
+        clock_hand = (clock_hand + 1) % DISK_CACHE_BLOCKS;
+
+        if (cache[slot].busy) continue;
+        if (cache[slot].block_num != -1 && cache[slot].referenced) {
+            cache[slot].referenced = 0; // Give the block a second chance
+            continue;
+        }
+        return slot;
+    }
+    return -1;
+}
+
+// Returns the slot caching block_num, claiming one on a miss. A dirty victim is
+// written back first. With fill set a missing block is read from the disk;
+// otherwise the caller must overwrite the whole slot before releasing
+// disk_lock. disk_lock is dropped for I/O, and the slot is busy meanwhile so
+// other threads wait for it instead of reading it again.
+// Caller must hold disk_lock. Returns the slot index, or -1 on I/O failure.
+static int cache_acquire(int block_num, int fill) {
+    int slot = -1;
+    for (;;) {
+        int cached = cache_lookup_idle(block_num);
+        if (cached != -1) {
+            cache_stats.hits++;
+            cache[cached].referenced = 1;
+            return cached;
+        }
+
+        // A victim written back on the previous pass is reused unless another
+        // thread got to it while the lock was dropped
+        if (slot == -1 || cache[slot].busy || cache[slot].dirty) slot = cache_victim();
+        if (slot == -1) {
+            pthread_cond_wait(&cache_idle, &disk_lock); // Every slot has I/O in flight
+            continue;
+        }
+        if (!cache[slot].dirty) break;
+        if (cache_writeback(slot) != 0) return -1;
+    }
+
+    cache_stats.misses++;
+    if (cache[slot].block_num != -1) {
+        cache_unhash(slot);
+        cache_stats.evictions++;
+    }
+    cache[slot].block_num = block_num;
+    cache[slot].dirty = 0;
+    cache[slot].referenced = 1;
+    cache[slot].hash_next = cache_hash[block_num % CACHE_HASH_SIZE];
+    cache_hash[block_num % CACHE_HASH_SIZE] = slot;
+    if (!fill) return slot;
+
+    cache[slot].busy = 1;
+    pthread_mutex_unlock(&disk_lock);
+    int result = raw_read(block_num, cache[slot].data);
+    pthread_mutex_lock(&disk_lock);
+    cache_unbusy(slot);
+    if (result != 0) {
+        cache_unhash(slot);
+        cache[slot].block_num = -1;
+        return -1;
+    }
+    return slot;
+}
+
+// Maps the whole image at path into memory for the mmap backend.
+// Returns 0 on success, -1 on failure.
+static int map_open(const char *path) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps its own reference to the file
+    if (map == MAP_FAILED) return -1;
+
+    disk_map = map;
+    disk_map_size = (size_t)st.st_size;
+    return 0;
+}
+
+// Opens the disk file at the specified path in read/write binary mode
+// using the default stdio backend.
 // Returns 0 on success, -1 on failure.
-int disk_open(const char *path) {  
-    disk_file = fopen(path, "r+b"); // Open file in read/write binary mode
-    return disk_file != NULL ? 0 : -1; // Check if the file was successfully opened
+int disk_open(const char *path) {
+    return disk_open_ex(path, DISK_BACKEND_STDIO);
 }
 
-// Closes the disk file if it is open.
+// Opens the disk file at the specified path with the requested backend.
+// The geometry starts out as DEFAULT_BLOCK_SIZE blocks covering the whole
+// file until disk_set_geometry() is called.
+// Returns 0 on success, -1 on failure.
+int disk_open_ex(const char *path, int backend) {
+    struct stat st;
+    int result;
+
+    disk_direct = (backend & DISK_OPEN_DIRECT) != 0;
+    backend &= ~DISK_OPEN_DIRECT;
+    if (disk_direct && backend != DISK_BACKEND_PREAD && backend != DISK_BACKEND_URING) {
+        fprintf(stderr, "disk_open_ex: DISK_OPEN_DIRECT needs the pread or uring backend\n");
+        disk_direct = 0;
+        return -1;
+    }
+
+    switch (backend) {
+    case DISK_BACKEND_STDIO:
+        disk_file = fopen(path, "r+b"); // Open file in read/write binary mode
+        result = disk_file != NULL && fstat(fileno(disk_file), &st) == 0 ? 0 : -1;
+        break;
+    case DISK_BACKEND_MMAP:
+        result = map_open(path);
+        st.st_size = (off_t)disk_map_size;
+        break;
+    case DISK_BACKEND_PREAD:
+    case DISK_BACKEND_URING:
+        disk_fd = open(path, disk_direct ? O_RDWR | O_DIRECT : O_RDWR);
+        result = disk_fd >= 0 && fstat(disk_fd, &st) == 0 ? 0 : -1;
+        // Without io_uring the backend silently behaves like DISK_BACKEND_PREAD
+        if (result == 0 && backend == DISK_BACKEND_URING) ring_setup();
+        break;
+    default:
+        return -1; // Unknown backend
+    }
+
+    block_size = DEFAULT_BLOCK_SIZE;
+    if (result == 0 && !disk_map) result = cache_setup();
+    if (result != 0) {
+        disk_close();
+        return -1;
+    }
+
+    image_size = st.st_size;
+    block_count = (uint32_t)(image_size / block_size);
+    return 0;
+}
+
+// Switches to a new block size and block count, typically the values stored
+// in the superblock. Dirty cached blocks are written back first.
+// Returns 0 on success, -1 if the geometry is invalid or does not fit the image.
+int disk_set_geometry(uint32_t new_block_size, uint32_t new_block_count) {
+    if (new_block_size < MIN_BLOCK_SIZE || new_block_size > MAX_BLOCK_SIZE) return -1;
+    if (new_block_size & (new_block_size - 1)) return -1; // Must be a power of two
+    if (new_block_count == 0 || (off_t)new_block_count * new_block_size > image_size) return -1;
+
+    int result = 0;
+    pthread_mutex_lock(&disk_lock);
+    if (!disk_map && cache_writeback_all() != 0) result = -1;
+    if (result == 0) {
+        block_size = new_block_size;
+        block_count = new_block_count;
+        if (!disk_map) result = cache_setup();
+    }
+    pthread_mutex_unlock(&disk_lock);
+    return result;
+}
+
+// Returns the current block size in bytes.
+uint32_t disk_block_size() {
+    return block_size;
+}
+
+// Returns the current number of blocks on the disk.
+uint32_t disk_block_count() {
+    return block_count;
+}
+
+// Closes the disk file if it is open, writing back any dirty cached blocks first.
 void disk_close() {
-    if (disk_file) fclose(disk_file); // Close the file if it is open
+    if (disk_file) {
+        disk_flush();
+        fclose(disk_file); // Close the file if it is open
+        disk_file = NULL;
+    }
+    if (disk_fd >= 0) {
+        while (disk_complete(DISK_QUEUE_DEPTH) > 0) {} // Drain outstanding requests
+        disk_flush();
+        ring_teardown();
+        close(disk_fd);
+        disk_fd = -1;
+        disk_direct = 0;
+    }
+    if (disk_map) {
+        msync(disk_map, disk_map_size, MS_SYNC);
+        munmap(disk_map, disk_map_size);
+        disk_map = NULL;
+        disk_map_size = 0;
+    }
+    free(cache_arena);
+    cache_arena = NULL;
+    cache_reset();
+    memset(requests, 0, sizeof(requests)); // Nothing queued carries over to the next disk_open()
+    block_count = 0;
+    image_size = 0;
+}
+
+// Returns a pointer to the block inside the memory-mapped image, or NULL if
+// the mmap backend is not in use or the block number is invalid.
+void *disk_map_block(int block_num) {
+    if (!disk_map || block_num < 0 || (uint32_t)block_num >= block_count) return NULL;
+    return disk_map + (size_t)block_num * block_size;
 }
 
 // Reads a block of data from the disk into the provided buffer.
@@ -23,17 +859,335 @@ void disk_close() {
 // buf: Pointer to the buffer where the data will be stored.
 // Returns 0 on success, -1 on failure.
 int disk_read(int block_num, void *buf) {
-    if (block_num < 0 || block_num >= BLOCK_COUNT) return -1; // Validate block number
-    fseek(disk_file, block_num * BLOCK_SIZE, SEEK_SET); // Move file pointer to the start of the block
-    return fread(buf, 1, BLOCK_SIZE, disk_file) == BLOCK_SIZE ? 0 : -1; // Read the block and check for success
+    if (block_num < 0 || (uint32_t)block_num >= block_count) return -1; // Validate block number
+
+    if (disk_map) {
+        memcpy(buf, disk_map_block(block_num), block_size);
+        return 0;
+    }
+
+    pthread_mutex_lock(&disk_lock);
+    int slot = cache_acquire(block_num, 1);
+    if (slot != -1) memcpy(buf, cache[slot].data, block_size);
+    pthread_mutex_unlock(&disk_lock);
+    return slot != -1 ? 0 : -1;
 }
 
 // Writes a block of data to the disk from the provided buffer.
+// The block is kept dirty in the cache until it is evicted or flushed.
 // block_num: The block number to write (0-based index).
 // buf: Pointer to the buffer containing the data to write.
 // Returns 0 on success, -1 on failure.
 int disk_write(int block_num, const void *buf) {
-    if (block_num < 0 || block_num >= BLOCK_COUNT) return -1; // Validate block number
-    fseek(disk_file, block_num * BLOCK_SIZE, SEEK_SET); // Move file pointer to the start of the block
-    return fwrite(buf, 1, BLOCK_SIZE, disk_file) == BLOCK_SIZE ? 0 : -1; // Write the block and check for success
+    if (block_num < 0 || (uint32_t)block_num >= block_count) return -1; // Validate block number
+
+    if (disk_map) {
+        memcpy(disk_map_block(block_num), buf, block_size);
+        return 0;
+    }
+
+    pthread_mutex_lock(&disk_lock);
+    int slot = cache_acquire(block_num, 0); // Whole-block write, so no need to read the old contents
+    if (slot != -1) {
+        cache[slot].dirty = 1;
+        memcpy(cache[slot].data, buf, block_size);
+    }
+    pthread_mutex_unlock(&disk_lock);
+    return slot != -1 ? 0 : -1;
+}
+
+// Returns 0 if every block number in vec is on the disk, -1 otherwise.
+static int check_vec(const DiskIoVec *vec, int count) {
+    for (int i = 0; i < count; i++) {
+        if (vec[i].block_num < 0 || (uint32_t)vec[i].block_num >= block_count) return -1;
+    }
+    return 0;
+}
+
+// Reads a scatter list of blocks. Blocks found in the cache are copied from it;
+// each run of consecutive uncached blocks is read with a single backend call,
+// and with io_uring all of those runs are in flight at once.
+// Bulk reads do not populate the cache, so streaming file data does not push
+// metadata out of it.
+// Returns 0 on success, -1 on failure.
+int disk_readv(const DiskIoVec *vec, int count) {
+    if (count < 0 || check_vec(vec, count) != 0) return -1;
+
+    if (disk_map) {
+        for (int i = 0; i < count; i++) {
+            memcpy(vec[i].buf, disk_map_block(vec[i].block_num), block_size);
+        }
+        return 0;
+    }
+
+    DiskIoVec *misses = malloc((size_t)(count > 0 ? count : 1) * sizeof(*misses));
+    if (!misses) return -1;
+
+    pthread_mutex_lock(&disk_lock);
+    int nmiss = 0;
+    for (int i = 0; i < count; i++) {
+        int slot = cache_lookup_idle(vec[i].block_num);
+        if (slot != -1) {
+            cache_stats.hits++;
+            cache[slot].referenced = 1;
+            memcpy(vec[i].buf, cache[slot].data, block_size);
+        } else {
+            misses[nmiss++] = vec[i];
+        }
+    }
+    cache_stats.misses += nmiss;
+    pthread_mutex_unlock(&disk_lock);
+    int result = io_vec(0, misses, nmiss);
+
+    free(misses);
+    return result;
+}
+
+// Writes a scatter list of blocks straight through to the disk, one backend
+// call per run of consecutive blocks. Cached copies are refreshed and marked
+// clean so the cache never holds stale data; they stay busy during the write so
+// an older dirty copy cannot be written back over the new data.
+// Returns 0 on success, -1 on failure.
+int disk_writev(const DiskIoVec *vec, int count) {
+    if (count < 0 || check_vec(vec, count) != 0) return -1;
+
+    if (disk_map) {
+        for (int i = 0; i < count; i++) {
+            memcpy(disk_map_block(vec[i].block_num), vec[i].buf, block_size);
+        }
+        return 0;
+    }
+
+    int *slots = malloc((size_t)(count > 0 ? count : 1) * sizeof(*slots));
+    if (!slots) return -1;
+
+    pthread_mutex_lock(&disk_lock);
+    for (int i = 0; i < count; i++) {
+        slots[i] = cache_lookup(vec[i].block_num);
+        if (slots[i] != -1 && cache[slots[i]].busy) {
+            pthread_cond_wait(&cache_idle, &disk_lock);
+            i = -1; // The lock was dropped, so look every block up again
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (slots[i] != -1) cache[slots[i]].busy = 1;
+    }
+    pthread_mutex_unlock(&disk_lock);
+
+    int result = io_vec(1, vec, count);
+
+    pthread_mutex_lock(&disk_lock);
+    for (int i = 0; i < count; i++) {
+        if (slots[i] == -1) continue;
+        if (result == 0) {
+            memcpy(cache[slots[i]].data, vec[i].buf, block_size);
+            cache[slots[i]].dirty = 0;
+        }
+        cache_unbusy(slots[i]);
+    }
+    // Another thread may have cached the old contents during the write
+    for (int i = 0; i < count && result == 0; i++) {
+        if (slots[i] != -1) continue;
+        int slot = cache_lookup_idle(vec[i].block_num);
+        if (slot != -1) {
+            memcpy(cache[slot].data, vec[i].buf, block_size);
+            cache[slot].dirty = 0;
+        }
+    }
+    pthread_mutex_unlock(&disk_lock);
+
+    free(slots);
+    return result;
+}
+
+// Reads count consecutive blocks starting at start_block into one buffer.
+// Returns 0 on success, -1 on failure.
+int disk_read_blocks(int start_block, int count, void *buf) {
+    DiskIoVec vec[DISK_MAX_RUN];
+    for (int done = 0; done < count; done += DISK_MAX_RUN) {
+        int n = count - done < DISK_MAX_RUN ? count - done : DISK_MAX_RUN;
+        for (int i = 0; i < n; i++) {
+            vec[i].block_num = start_block + done + i;
+            vec[i].buf = (char *)buf + (size_t)(done + i) * block_size;
+        }
+        if (disk_readv(vec, n) != 0) return -1;
+    }
+    return 0;
+}
+
+// Writes count consecutive blocks starting at start_block from one buffer.
+// Returns 0 on success, -1 on failure.
+int disk_write_blocks(int start_block, int count, const void *buf) {
+    DiskIoVec vec[DISK_MAX_RUN];
+    for (int done = 0; done < count; done += DISK_MAX_RUN) {
+        int n = count - done < DISK_MAX_RUN ? count - done : DISK_MAX_RUN;
+        for (int i = 0; i < n; i++) {
+            vec[i].block_num = start_block + done + i;
+            vec[i].buf = (char *)buf + (size_t)(done + i) * block_size;
+        }
+        if (disk_writev(vec, n) != 0) return -1;
+    }
+    return 0;
+}
+
+// Queues an asynchronous one-block request. Cache hits and the mmap backend
+// complete immediately; the callback still runs from disk_complete().
+// Returns 0 on success, -1 if the block is invalid or the queue is full.
+static int queue_request(int is_write, int block_num, void *buf, DiskCallback callback, void *arg) {
+    if (block_num < 0 || (uint32_t)block_num >= block_count) return -1;
+    if (disk_direct && !is_aligned(buf)) return -1; // Kernel would reject it
+
+    pthread_mutex_lock(&disk_lock);
+    int slot = disk_map ? -1 : cache_lookup_idle(block_num);
+    pthread_mutex_lock(&ring_lock);
+    int idx = req_alloc();
+    if (idx < 0) {
+        pthread_mutex_unlock(&ring_lock);
+        pthread_mutex_unlock(&disk_lock);
+        return -1;
+    }
+
+    DiskRequest *req = &requests[idx];
+    req->is_write = is_write;
+    req->block_num = block_num;
+    req->single.iov_base = buf;
+    req->single.iov_len = block_size;
+    req->iov = &req->single;
+    req->iovcnt = 1;
+    req->expected = block_size;
+    req->callback = callback;
+    req->arg = arg;
+    req->state = REQ_QUEUED;
+
+    if (disk_map) {
+        if (is_write) memcpy(disk_map_block(block_num), buf, block_size);
+        else memcpy(buf, disk_map_block(block_num), block_size);
+        req->state = REQ_DONE;
+    } else if (slot != -1 && !is_write) {
+        cache_stats.hits++;
+        memcpy(buf, cache[slot].data, block_size);
+        req->state = REQ_DONE;
+    } else if (slot != -1) {
+        memcpy(cache[slot].data, buf, block_size); // Keep the cached copy current
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+    pthread_mutex_unlock(&disk_lock);
+    return 0;
+}
+
+// Queues an asynchronous read of one block into buf.
+int disk_queue_read(int block_num, void *buf, DiskCallback callback, void *arg) {
+    return queue_request(0, block_num, buf, callback, arg);
+}
+
+// Queues an asynchronous write of one block from buf.
+int disk_queue_write(int block_num, const void *buf, DiskCallback callback, void *arg) {
+    return queue_request(1, block_num, (void *)buf, callback, arg);
+}
+
+// Hands every queued request to the kernel in one batch, or performs them
+// synchronously when io_uring is not in use.
+// Returns the number of requests submitted, or -1 on failure.
+int disk_submit() {
+    pthread_mutex_lock(&ring_lock);
+    int submitted = 0;
+    unsigned pushed = 0;
+    int result = 0;
+
+    for (int i = 0; i < DISK_QUEUE_DEPTH; i++) {
+        if (requests[i].state != REQ_QUEUED) continue;
+        if (ring.fd >= 0 && ring_push(i) == 0) {
+            pushed++;
+        } else {
+            req_execute_sync(&requests[i]);
+        }
+        submitted++;
+    }
+    if (pushed > 0 && ring_enter(pushed, 0) != 0) {
+        ring_unpush(); // Their callbacks report the failure
+        result = -1;
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+    return result == 0 ? submitted : -1;
+}
+
+// Waits until at least min_complete submitted requests have finished (or none
+// are left in flight), then runs the callbacks of every finished request.
+// Returns the number of callbacks run.
+int disk_complete(int min_complete) {
+    struct {
+        DiskCallback callback;
+        void *arg;
+        int block_num;
+        int result;
+    } done[DISK_QUEUE_DEPTH];
+    int ndone = 0;
+
+    pthread_mutex_lock(&ring_lock);
+    for (;;) {
+        int finished = 0, inflight = 0;
+        for (int i = 0; i < DISK_QUEUE_DEPTH; i++) {
+            if (requests[i].internal) continue;
+            if (requests[i].state == REQ_DONE) finished++;
+            if (requests[i].state == REQ_INFLIGHT) inflight++;
+        }
+        if (finished >= min_complete || inflight == 0 || ring.fd < 0) break;
+        if (ring_enter(0, 1) != 0) break;
+        ring_reap();
+    }
+    if (ring.fd >= 0) ring_reap();
+
+    for (int i = 0; i < DISK_QUEUE_DEPTH; i++) {
+        if (requests[i].internal || requests[i].state != REQ_DONE) continue;
+        done[ndone].callback = requests[i].callback;
+        done[ndone].arg = requests[i].arg;
+        done[ndone].block_num = requests[i].block_num;
+        done[ndone].result = requests[i].result;
+        ndone++;
+        requests[i].state = REQ_FREE;
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    // Callbacks run without the lock so they may issue further disk I/O
+    for (int i = 0; i < ndone; i++) {
+        if (done[i].callback) done[i].callback(done[i].block_num, done[i].result, done[i].arg);
+    }
+    return ndone;
+}
+
+// Writes every dirty cached block back to the disk file. With the mmap backend
+// the mapping is already shared with the file, so writeback is only scheduled.
+// Returns 0 on success, -1 if any block could not be written.
+int disk_flush() {
+    if (disk_map) return msync(disk_map, disk_map_size, MS_ASYNC) == 0 ? 0 : -1;
+    if (!disk_file && disk_fd < 0) return -1;
+
+    pthread_mutex_lock(&disk_lock);
+    int result = cache_writeback_all();
+    pthread_mutex_unlock(&disk_lock);
+
+    if (disk_file) {
+        pthread_mutex_lock(&stdio_lock);
+        if (fflush(disk_file) != 0) result = -1;
+        pthread_mutex_unlock(&stdio_lock);
+    }
+    return result;
+}
+
+// Flushes the disk and forces the image onto stable storage.
+// Returns 0 on success, -1 on failure.
+int disk_sync() {
+    if (disk_map) return msync(disk_map, disk_map_size, MS_SYNC) == 0 ? 0 : -1;
+    if (disk_flush() != 0) return -1;
+    return fsync(disk_fd >= 0 ? disk_fd : fileno(disk_file)) == 0 ? 0 : -1;
+}
+
+// Copies the current cache counters into *stats.
+void disk_cache_stats(DiskCacheStats *stats) {
+    if (!stats) return;
+    pthread_mutex_lock(&disk_lock);
+    *stats = cache_stats;
+    pthread_mutex_unlock(&disk_lock);
 }
@@ -3,13 +3,46 @@
  * @brief Header file for disk operations in a simple file system implementation.
  *
  * This file defines the interface for interacting with a virtual disk, including
- * opening, closing, reading, and writing operations. It also specifies constants
- * for block size and block count.
+ * opening, closing, reading, and writing operations. It also specifies the
+ * limits and defaults for the disk geometry. The actual block size and block
+ * count are set at runtime with disk_set_geometry(), normally from the values
+ * stored in the file system's superblock.
+ *
+ * Reads and writes go through a fixed-size write-back block cache with CLOCK
+ * replacement. Dirty blocks reach the disk file when they are evicted, on
+ * disk_flush(), or on disk_close().
+ *
+ * The disk can also be opened with a memory-mapped backend (DISK_BACKEND_MMAP).
+ * The cache is bypassed in that mode, and disk_map_block() hands out pointers
+ * straight into the mapped image so readers can avoid a copy.
+ *
+ * DISK_BACKEND_PREAD uses pread()/pwrite() on a plain file descriptor, so there
+ * is no shared file position. The block cache is guarded by a mutex, which makes
+ * every call safe from several threads at once. The mutex is not held during
+ * disk I/O: a slot being read or written back is marked busy, and only threads
+ * that need that block wait for it, so cache misses in different threads
+ * overlap. The stdio backend still serializes its transfers on the shared FILE.
+ *
+ * DISK_BACKEND_URING drives the same file descriptor through an io_uring
+ * instance. Vectored transfers and cache flushes put all their runs in flight
+ * at once, and single-block requests can be queued with disk_queue_read() and
+ * disk_queue_write(), handed to the kernel in one batch with disk_submit(), and
+ * collected with disk_complete(). When io_uring is unavailable the backend falls
+ * back to synchronous pread()/pwrite().
+ *
+ * Either file descriptor backend can be combined with DISK_OPEN_DIRECT to open
+ * the image with O_DIRECT, so blocks are cached only once, by the block cache,
+ * and not again by the host page cache. Transfers must then use buffers aligned
+ * to the block size; the disk layer bounces unaligned buffers passed to
+ * disk_readv() and disk_writev(), and buffers declared with DISK_ALIGNED never
+ * need it.
  */
 
 #ifndef DISK_H
 #define DISK_H
 
+#include <stdint.h>
+
 /**
  * @brief Opens a virtual disk file.
  *
@@ -21,11 +54,78 @@
  */
 int disk_open(const char *path);
 
+/**
+ * @def DISK_BACKEND_STDIO
+ * @brief Backend that accesses the image through a stdio FILE and the block cache.
+ */
+#define DISK_BACKEND_STDIO 0
+
+/**
+ * @def DISK_BACKEND_MMAP
+ * @brief Backend that maps the whole image into memory with mmap().
+ */
+#define DISK_BACKEND_MMAP 1
+
+/**
+ * @def DISK_BACKEND_PREAD
+ * @brief Backend that uses positional pread()/pwrite() on a file descriptor.
+ */
+#define DISK_BACKEND_PREAD 2
+
+/**
+ * @def DISK_BACKEND_URING
+ * @brief Backend that submits batched asynchronous requests through io_uring.
+ */
+#define DISK_BACKEND_URING 3
+
+/**
+ * @def DISK_OPEN_DIRECT
+ * @brief Flag OR'ed into the backend of disk_open_ex() to bypass the host page cache.
+ *
+ * Only valid with DISK_BACKEND_PREAD and DISK_BACKEND_URING. The block size must
+ * be a multiple of the logical sector size of the device holding the image.
+ */
+#define DISK_OPEN_DIRECT 0x100
+
+/**
+ * @brief Opens a virtual disk file with the given backend.
+ *
+ * disk_open() is equivalent to disk_open_ex(path, DISK_BACKEND_STDIO).
+ *
+ * @param path The path to the virtual disk file.
+ * @param backend One of the DISK_BACKEND_* constants, optionally OR'ed with DISK_OPEN_DIRECT.
+ * @return 0 on success, or a negative value on failure.
+ */
+int disk_open_ex(const char *path, int backend);
+
+/**
+ * @brief Sets the block size and block count of the open virtual disk.
+ *
+ * Dirty cached blocks are written back under the old geometry before the
+ * switch. A freshly opened disk uses DEFAULT_BLOCK_SIZE blocks covering the
+ * whole image until this is called.
+ *
+ * @param block_size Block size in bytes; a power of two between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE.
+ * @param block_count Number of blocks; must fit inside the image file.
+ * @return 0 on success, or a negative value if the geometry is invalid.
+ */
+int disk_set_geometry(uint32_t block_size, uint32_t block_count);
+
+/**
+ * @brief Returns the current block size of the virtual disk in bytes.
+ */
+uint32_t disk_block_size();
+
+/**
+ * @brief Returns the current number of blocks on the virtual disk.
+ */
+uint32_t disk_block_count();
+
 /**
  * @brief Closes the virtual disk file.
  *
- * This function closes the virtual disk file and releases any resources associated
- * with it.
+ * This function writes back any dirty cached blocks, closes the virtual disk file
+ * and releases any resources associated with it.
  */
 void disk_close();
 
@@ -52,19 +152,230 @@ int disk_read(int block_num, void *buf);
 int disk_write(int block_num, const void *buf);
 
 /**
- * @def BLOCK_SIZE
- * @brief The size of a single block in bytes.
+ * @struct DiskIoVec
+ * @brief One element of a scatter/gather list for disk_readv() and disk_writev().
+ *
+ * @param block_num The block number to transfer (0-based index).
+ * @param buf Buffer of one block holding or receiving the data. disk_writev()
+ *            only reads from it.
+ */
+typedef struct {
+    int block_num;
+    void *buf;
+} DiskIoVec;
+
+/**
+ * @brief Reads a scatter list of blocks in as few backend calls as possible.
+ *
+ * Blocks already in the cache are copied from it. Each run of consecutive
+ * uncached block numbers is read with one call (a single preadv() for the
+ * pread backend). Blocks read this way are not added to the cache.
+ *
+ * @param vec Array of block numbers and destination buffers.
+ * @param count Number of elements in vec.
+ * @return 0 on success, or a negative value on failure.
+ */
+int disk_readv(const DiskIoVec *vec, int count);
+
+/**
+ * @brief Writes a scatter list of blocks in as few backend calls as possible.
+ *
+ * Each run of consecutive block numbers is written through to the disk with
+ * one call. Any cached copies are updated and marked clean.
+ *
+ * @param vec Array of block numbers and source buffers.
+ * @param count Number of elements in vec.
+ * @return 0 on success, or a negative value on failure.
+ */
+int disk_writev(const DiskIoVec *vec, int count);
+
+/**
+ * @brief Reads a run of consecutive blocks into a single buffer.
  *
- * This constant defines the size of each block in the virtual disk.
+ * @param start_block The first block number to read.
+ * @param count Number of blocks to read.
+ * @param buf Buffer of at least count blocks.
+ * @return 0 on success, or a negative value on failure.
  */
-#define BLOCK_SIZE 1024
+int disk_read_blocks(int start_block, int count, void *buf);
 
 /**
- * @def BLOCK_COUNT
- * @brief The total number of blocks in the virtual disk.
+ * @brief Writes a run of consecutive blocks from a single buffer.
  *
- * This constant defines the total number of blocks available in the virtual disk.
+ * @param start_block The first block number to write.
+ * @param count Number of blocks to write.
+ * @param buf Buffer of at least count blocks.
+ * @return 0 on success, or a negative value on failure.
+ */
+int disk_write_blocks(int start_block, int count, const void *buf);
+
+/**
+ * @brief Callback run by disk_complete() when a queued request finishes.
+ *
+ * @param block_num The block number of the request.
+ * @param result 0 on success, or a negative value on failure.
+ * @param arg The argument given when the request was queued.
+ */
+typedef void (*DiskCallback)(int block_num, int result, void *arg);
+
+/**
+ * @brief Queues an asynchronous read of one block.
+ *
+ * The request is not started until disk_submit(). buf must stay valid until
+ * the callback has run, and must be aligned to the block size with DISK_OPEN_DIRECT.
+ *
+ * @param block_num The block number to read from (0-based index).
+ * @param buf Buffer of one block receiving the data.
+ * @param callback Function run from disk_complete(), or NULL.
+ * @param arg Argument passed to the callback.
+ * @return 0 on success, or a negative value if the block is invalid or the queue is full.
+ */
+int disk_queue_read(int block_num, void *buf, DiskCallback callback, void *arg);
+
+/**
+ * @brief Queues an asynchronous write of one block.
+ *
+ * The write goes straight to the disk file once submitted; a cached copy of the
+ * block is updated at queue time. buf must stay valid until the callback has run,
+ * and must be aligned to the block size with DISK_OPEN_DIRECT.
+ *
+ * @param block_num The block number to write to (0-based index).
+ * @param buf Buffer of one block holding the data.
+ * @param callback Function run from disk_complete(), or NULL.
+ * @param arg Argument passed to the callback.
+ * @return 0 on success, or a negative value if the block is invalid or the queue is full.
+ */
+int disk_queue_write(int block_num, const void *buf, DiskCallback callback, void *arg);
+
+/**
+ * @brief Submits every queued request with a single system call.
+ *
+ * Without io_uring the requests are carried out synchronously here.
+ *
+ * @return The number of requests submitted, or a negative value on failure.
+ */
+int disk_submit();
+
+/**
+ * @brief Waits for submitted requests and runs their callbacks.
+ *
+ * Blocks until at least min_complete requests have finished or none remain in
+ * flight. Callbacks run without any disk lock held and may queue more I/O.
+ *
+ * @param min_complete The number of finished requests to wait for.
+ * @return The number of callbacks run.
+ */
+int disk_complete(int min_complete);
+
+/**
+ * @brief Returns a pointer to a block inside the memory-mapped image.
+ *
+ * Reads and writes through the pointer access the image directly, without a
+ * copy. The pointer stays valid until disk_close().
+ *
+ * @param block_num The block number to map (0-based index).
+ * @return Pointer to the block, or NULL if the mmap backend is not in use.
+ */
+void *disk_map_block(int block_num);
+
+/**
+ * @brief Writes all dirty cached blocks back to the virtual disk.
+ *
+ * @return 0 on success, or a negative value if any block could not be written.
+ */
+int disk_flush();
+
+/**
+ * @brief Flushes the virtual disk and forces it onto stable storage.
+ *
+ * For the mmap backend this is the msync() durability point.
+ *
+ * @return 0 on success, or a negative value on failure.
+ */
+int disk_sync();
+
+/**
+ * @struct DiskCacheStats
+ * @brief Counters describing the behaviour of the block cache.
+ *
+ * @param hits Reads and writes served by a block already in the cache.
+ * @param misses Reads and writes that had to claim a new cache slot.
+ * @param evictions Blocks dropped from the cache to make room for another.
+ * @param writebacks Dirty blocks written back to the disk file.
+ */
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long writebacks;
+} DiskCacheStats;
+
+/**
+ * @brief Returns the block cache counters accumulated since disk_open().
+ *
+ * @param stats Pointer to the structure that receives the counters.
+ */
+void disk_cache_stats(DiskCacheStats *stats);
+
+/**
+ * @def DEFAULT_BLOCK_SIZE
+ * @brief The default size of a single block in bytes.
+ *
+ * This is the block size a newly opened disk uses before its geometry is set,
+ * and the block size mkfs uses when none is given.
+ */
+#define DEFAULT_BLOCK_SIZE 1024
+
+/**
+ * @def DEFAULT_BLOCK_COUNT
+ * @brief The default total number of blocks for a new virtual disk.
+ */
+#define DEFAULT_BLOCK_COUNT 1024
+
+/**
+ * @def MIN_BLOCK_SIZE
+ * @brief The smallest supported block size in bytes.
+ */
+#define MIN_BLOCK_SIZE 512
+
+/**
+ * @def MAX_BLOCK_SIZE
+ * @brief The largest supported block size in bytes.
+ *
+ * Buffers that must hold any single block are sized with this constant.
+ */
+#define MAX_BLOCK_SIZE 4096
+
+/**
+ * @def DISK_ALIGN
+ * @brief Alignment in bytes of block buffers suitable for direct I/O.
+ *
+ * At least MAX_BLOCK_SIZE, so a buffer with this alignment suits every block size.
+ */
+#define DISK_ALIGN 4096
+
+/**
+ * @def DISK_ALIGNED
+ * @brief Attribute that aligns a block buffer declaration to DISK_ALIGN.
+ */
+#define DISK_ALIGNED __attribute__((aligned(DISK_ALIGN)))
+
+/**
+ * @def DISK_CACHE_BLOCKS
+ * @brief The number of blocks held by the block cache.
+ */
+#define DISK_CACHE_BLOCKS 64
+
+/**
+ * @def DISK_MAX_RUN
+ * @brief The largest number of blocks moved by a single vectored backend call.
+ */
+#define DISK_MAX_RUN 256
+
+/**
+ * @def DISK_QUEUE_DEPTH
+ * @brief The largest number of asynchronous requests outstanding at once.
  */
-#define BLOCK_COUNT 1024
+#define DISK_QUEUE_DEPTH 64
 
 #endif
\ No newline at end of file
@@ -7,8 +7,54 @@
 #include <time.h>
 
 
-// Global buffer for bitmap (loaded once)
-static uint8_t bitmap[BLOCK_SIZE];
+// Superblock of the mounted filesystem; all geometry is taken from here
+static SuperBlock superblock;
+
+// Non-zero if superblock has changes not yet written to disk
+static int superblock_dirty = 0;
+
+// In-memory copy of the block bitmap (loaded once). It spans the blocks from
+// BITMAP_BLOCK up to the inode table; each bitmap block covers one group of
+// block_size * 8 data blocks.
+static uint8_t *bitmap = NULL;
+static uint32_t bitmap_blocks = 0;
+
+// Per bitmap block: non-zero if it has changes not yet written to disk
+static uint8_t *bitmap_dirty = NULL;
+
+// Number of free data blocks in each group, so full groups can be skipped
+static uint32_t *group_free = NULL;
+
+// In-memory copy of the whole inode table (loaded once at init_fs)
+static uint8_t *inode_table = NULL;
+
+// Per inode table block: non-zero if it has changes not yet written to disk
+static uint8_t *inode_dirty = NULL;
+
+// Relative data block where the next allocation search starts (next-fit)
+static uint32_t alloc_hint = 0;
+
+// An open file: its inode number, a copy of its inode and the current offset
+typedef struct {
+    int in_use;
+    int inum;
+    Inode inode;
+    size_t pos;
+} OpenFile;
+
+// Open file table; the handles returned by open_fs index into it
+static OpenFile open_files[MAX_OPEN_FILES];
+
+// Number of data blocks tracked by the bitmap
+static uint32_t data_block_count() {
+    return superblock.fs_size_blocks - superblock.data_start;
+}
+
+// Number of blocks occupied by the inode table
+static uint32_t inode_table_blocks(uint32_t inode_count, uint32_t block_size) {
+    uint32_t inodes_per_block = block_size / sizeof(Inode);
+    return (inode_count + inodes_per_block - 1) / inodes_per_block;
+}
 
 void log_debug(const char *format, ...) {
     FILE *log_file = fopen("run_log.txt", "a");
@@ -23,238 +69,1847 @@ void log_debug(const char *format, ...) {
     fclose(log_file);
 }
 
-// Load bitmap from disk
+// Returns a pointer to the contents of a block. With the mmap backend this
+// points straight into the mapped image; otherwise the block is read into scratch.
+// Returns NULL on failure.
+static const void *read_block_ref(int block_num, void *scratch) {
+    const void *mapped = disk_map_block(block_num);
+    if (mapped) return mapped;
+    return disk_read(block_num, scratch) == 0 ? scratch : NULL;
+}
+
+// Number of data blocks in one bitmap group
+static uint32_t group_size() {
+    return superblock.block_size * 8;
+}
+
+// Number of data blocks in group g; only the last group may be short
+static uint32_t group_blocks(uint32_t g) {
+    uint32_t first = g * group_size();
+    uint32_t left = data_block_count() - first;
+    return left < group_size() ? left : group_size();
+}
+
+// Returns 64 bits of the bitmap starting at bit word * 64. Bit i of the result
+// is the bit for relative block word * 64 + i, regardless of host byte order.
+static uint64_t bitmap_word(uint32_t word) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | bitmap[(size_t)word * 8 + i];
+    }
+    return value;
+}
+
+// Releases the in-memory bitmap and its summary
+static void release_bitmap() {
+    free(bitmap);
+    free(bitmap_dirty);
+    free(group_free);
+    bitmap = NULL;
+    bitmap_dirty = NULL;
+    group_free = NULL;
+    bitmap_blocks = 0;
+}
+
+// Load bitmap from disk and count the free blocks of every group
 void load_bitmap() {
-    disk_read(BITMAP_BLOCK, bitmap);
+    release_bitmap();
+    uint32_t groups = (data_block_count() + group_size() - 1) / group_size();
+    uint32_t blocks = superblock.inode_start - BITMAP_BLOCK;
+
+    bitmap = malloc((size_t)blocks * superblock.block_size);
+    bitmap_dirty = calloc(blocks, 1);
+    group_free = calloc(groups, sizeof(*group_free));
+    if (!bitmap || !bitmap_dirty || !group_free ||
+        disk_read_blocks(BITMAP_BLOCK, (int)blocks, bitmap) != 0) {
+        fprintf(stderr, "load_bitmap: Failed to load %u bitmap blocks\n", blocks);
+        release_bitmap();
+        return;
+    }
+    bitmap_blocks = blocks;
+
+    for (uint32_t g = 0; g < groups; g++) {
+        uint32_t first = g * group_size();
+        uint32_t used = 0;
+        uint32_t end = first + group_blocks(g);
+        for (uint32_t w = first / 64; w * 64 < end; w++) {
+            uint64_t bits = bitmap_word(w);
+            if (w * 64 + 64 > end) bits &= ~0ULL >> (w * 64 + 64 - end); // Ignore padding bits
+            used += (uint32_t)__builtin_popcountll(bits);
+        }
+        group_free[g] = group_blocks(g) - used;
+    }
+    alloc_hint = 0;
 }
 
-// Save bitmap to disk
+// Writes every block of an in-memory metadata region whose dirty flag is set,
+// in one vectored call, and clears the flags. The region holds count blocks
+// starting at first_block.
+// Returns 0 on success, -1 on failure.
+static int write_dirty_blocks(int first_block, uint8_t *data, uint8_t *dirty, uint32_t count) {
+    DiskIoVec *vec = malloc((size_t)(count > 0 ? count : 1) * sizeof(*vec));
+    if (!vec) return -1;
+
+    int n = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!dirty[i]) continue;
+        vec[n].block_num = first_block + (int)i;
+        vec[n].buf = data + (size_t)i * superblock.block_size;
+        n++;
+    }
+
+    int result = disk_writev(vec, n);
+    free(vec);
+    if (result == 0) memset(dirty, 0, count);
+    return result;
+}
+
+// Save every bitmap block that has changed since it was last saved
 void save_bitmap() {
-    disk_write(BITMAP_BLOCK, bitmap);
+    write_dirty_blocks(BITMAP_BLOCK, bitmap, bitmap_dirty, bitmap_blocks);
+}
+
+// Returns non-zero if any bitmap block has unsaved changes
+static int bitmap_has_dirty() {
+    for (uint32_t i = 0; i < bitmap_blocks; i++) {
+        if (bitmap_dirty[i]) return 1;
+    }
+    return 0;
+}
+
+// Releases the in-memory inode table
+static void release_inode_table() {
+    free(inode_table);
+    free(inode_dirty);
+    inode_table = NULL;
+    inode_dirty = NULL;
+}
+
+// Loads the whole inode table into memory.
+// Returns 0 on success, -1 on failure.
+static int load_inode_table() {
+    release_inode_table();
+    uint32_t blocks = inode_table_blocks(superblock.inode_count, superblock.block_size);
+
+    inode_table = malloc((size_t)blocks * superblock.block_size);
+    inode_dirty = calloc(blocks, 1);
+    if (!inode_table || !inode_dirty ||
+        disk_read_blocks((int)superblock.inode_start, (int)blocks, inode_table) != 0) {
+        fprintf(stderr, "load_inode_table: Failed to load %u inode table blocks\n", blocks);
+        release_inode_table();
+        return -1;
+    }
+    return 0;
+}
+
+// Writes back every inode table block changed since it was last saved.
+// Returns 0 on success, -1 on failure.
+static int save_inode_table() {
+    if (!inode_table) return 0;
+    uint32_t blocks = inode_table_blocks(superblock.inode_count, superblock.block_size);
+    return write_dirty_blocks((int)superblock.inode_start, inode_table, inode_dirty, blocks);
 }
 
 // Mark a block as used
 void mark_block_used(int block_num) {
-    int rel = block_num - DATA_BLOCK_START;
+    uint32_t rel = (uint32_t)(block_num - (int)superblock.data_start);
+    if (bitmap[rel / 8] & (1 << (rel % 8))) return;
     bitmap[rel / 8] |= (1 << (rel % 8));
+    bitmap_dirty[rel / 8 / superblock.block_size] = 1;
+    group_free[rel / group_size()]--;
 }
 
 // Mark a block as free
 void mark_block_free(int block_num) {
-    int rel = block_num - DATA_BLOCK_START;
+    uint32_t rel = (uint32_t)(block_num - (int)superblock.data_start);
+    if (!(bitmap[rel / 8] & (1 << (rel % 8)))) return;
     bitmap[rel / 8] &= ~(1 << (rel % 8));
+    bitmap_dirty[rel / 8 / superblock.block_size] = 1;
+    group_free[rel / group_size()]++;
 }
 
 // Check if block is free
 int is_block_free(int block_num) {
-    int rel = block_num - DATA_BLOCK_START;
+    uint32_t rel = (uint32_t)(block_num - (int)superblock.data_start);
     return !(bitmap[rel / 8] & (1 << (rel % 8)));
 }
 
-// Allocate a free block and return its number, or -1 if full
-int allocate_block() {
-    for (int i = 0; i < DATA_BLOCK_COUNT; i++) {
-        int block_num = i + DATA_BLOCK_START;
-        if (is_block_free(block_num)) {
-            mark_block_used(block_num);
-            save_bitmap();
+// Returns the first relative data block in [start, end) that is free (want_free)
+// or used (!want_free), or -1 if none. Groups that cannot match, judging by their
+// free count, are skipped whole; within a group the scan goes a 64-bit word at a
+// time and uses count-trailing-zeros on the matching bits.
+static int find_block_bit(uint32_t start, uint32_t end, int want_free) {
+    uint32_t words_per_group = group_size() / 64;
+    for (uint32_t word = start / 64; word * 64 < end; word++) {
+        uint32_t g = word / words_per_group;
+        if (group_free[g] == (want_free ? 0 : group_blocks(g))) {
+            word = (g + 1) * words_per_group - 1; // Nothing to find in this group
+            continue;
+        }
+
+        uint64_t bits = bitmap_word(word);
+        if (want_free) bits = ~bits;
+        if (word == start / 64) bits &= ~0ULL << (start % 64);
+        if (bits) {
+            uint32_t rel = word * 64 + (uint32_t)__builtin_ctzll(bits);
+            return rel < end ? (int)rel : -1;
+        }
+    }
+    return -1;
+}
+
+// Looks for a run of free relative data blocks in [start, end). Returns the first
+// run of at least want blocks, or failing that the longest run, with its length
+// in *run_len. Returns -1 if the range has no free block.
+static int find_free_run(uint32_t start, uint32_t end, uint32_t want, uint32_t *run_len) {
+    int best = -1;
+    uint32_t best_len = 0;
+
+    for (uint32_t pos = start; pos < end;) {
+        int run = find_block_bit(pos, end, 1);
+        if (run < 0) break;
+        int used = find_block_bit((uint32_t)run, end, 0);
+        uint32_t stop = used < 0 ? end : (uint32_t)used;
+        uint32_t len = stop - (uint32_t)run;
+        if (len >= want) {
+            *run_len = len;
+            return run;
+        }
+        if (len > best_len) {
+            best = run;
+            best_len = len;
+        }
+        pos = stop;
+    }
+
+    *run_len = best_len;
+    return best;
+}
+
+// Allocate count data blocks into blocks[], as one contiguous run if possible and
+// otherwise in as few runs as possible. Either all blocks are allocated or none.
+// Returns 0 on success, -1 if there are not enough free blocks.
+int allocate_blocks(uint32_t count, uint32_t *blocks) {
+    uint32_t total = data_block_count();
+    if (alloc_hint >= total) alloc_hint = 0;
+
+    uint32_t got = 0;
+    while (got < count) {
+        uint32_t want = count - got;
+
+        // Next-fit: search from where the last allocation ended, then wrap around
+        uint32_t len, wrapped_len;
+        int run = find_free_run(alloc_hint, total, want, &len);
+        if (len < want) {
+            int wrapped = find_free_run(0, alloc_hint, want, &wrapped_len);
+            if (wrapped_len > len) {
+                run = wrapped;
+                len = wrapped_len;
+            }
+        }
+
+        if (run < 0) {
+            // Out of space: give back what was taken so far
+            for (uint32_t i = 0; i < got; i++) mark_block_free((int)blocks[i]);
+            return -1;
+        }
+
+        if (len > want) len = want;
+        for (uint32_t i = 0; i < len; i++) {
+            int block_num = run + (int)i + (int)superblock.data_start;
+            mark_block_used(block_num); // Persisted by save_bitmap() at sync time
+            blocks[got++] = (uint32_t)block_num;
             log_debug("[DEBUG] Allocated data block %d", block_num);
-            return block_num;
         }
+        alloc_hint = (uint32_t)run + len;
     }
-    return -1; // No free block found
+    return 0;
+}
+
+// Allocate a free block and return its number, or -1 if full
+int allocate_block() {
+    uint32_t block_num;
+    return allocate_blocks(1, &block_num) == 0 ? (int)block_num : -1;
 }
 
 // Free a block
 void free_block(int block_num) {
-    mark_block_free(block_num);
-    save_bitmap();
+    mark_block_free(block_num); // Persisted by save_bitmap() at sync time
     log_debug("[DEBUG] Freed data block %d", block_num);
 }
 
 // Inode operations
 
+// Returns the slot of inode inum in an inode table image that starts at table.
+// Inodes never straddle blocks, so each block may end in a few unused bytes.
+static Inode *inode_slot(uint8_t *table, uint32_t inum, uint32_t block_size) {
+    uint32_t inodes_per_block = block_size / sizeof(Inode);
+    return (Inode *)(table + (size_t)(inum / inodes_per_block) * block_size) + inum % inodes_per_block;
+}
+
+// Returns a pointer to inode inum inside the in-memory inode table, marking
+// its block dirty if for_write is set. Returns NULL for an invalid inode number.
+static Inode *inode_ref(int inum, int for_write) {
+    if (inum < 0 || inum >= (int)superblock.inode_count || !inode_table) return NULL;
+
+    if (for_write) inode_dirty[(uint32_t)inum / (superblock.block_size / sizeof(Inode))] = 1;
+    return inode_slot(inode_table, (uint32_t)inum, superblock.block_size);
+}
+
 int read_inode(int inum, Inode *inode) {
-    if (inum < 0 || inum >= INODE_COUNT) return -1;
+    const Inode *cached = inode_ref(inum, 0);
+    if (!cached) return -1;
+    *inode = *cached;
+    return 0;
+}
+
+// Updates the in-memory inode table; the block reaches the disk at sync time
+int write_inode(int inum, Inode *inode) {
+    Inode *cached = inode_ref(inum, 1);
+    if (!cached) return -1;
+    *cached = *inode;
+
+    // Keep the inode copies held by open handles current
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (open_files[i].in_use && open_files[i].inum == inum) open_files[i].inode = *cached;
+    }
+    return 0;
+}
+
+// Free inodes form a singly linked list that starts at superblock.free_inode_head.
+// A free inode keeps the number of the next free inode in direct_blocks[0].
+#define FREE_INODE_NEXT(inode) ((inode)->direct_blocks[0])
+
+// Pops the first inode off the free list, so allocation takes constant time
+int allocate_inode() {
+    int inum = (int)superblock.free_inode_head;
+    Inode *inode = inode_ref(inum, 1);
+    if (!inode) return -1;  // No free inode
+
+    superblock.free_inode_head = FREE_INODE_NEXT(inode);
+    superblock.free_inode_count--;
+    superblock_dirty = 1;
+
+    memset(inode, 0, sizeof(*inode));
+    inode->is_valid = 1;
+    log_debug("[DEBUG] Allocated inode %d", inum);
+    return inum;
+}
+
+// Invalidates an inode and pushes it onto the free list
+void free_inode(int inum) {
+    Inode *inode = inode_ref(inum, 1);
+    if (!inode || !inode->is_valid || inum == ROOT_INODE) return;
+
+    // Handles on a deleted file go stale rather than follow the inode number
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (open_files[i].inum == inum) open_files[i].in_use = 0;
+    }
+
+    memset(inode, 0, sizeof(*inode));
+    FREE_INODE_NEXT(inode) = superblock.free_inode_head;
+    superblock.free_inode_head = (uint32_t)inum;
+    superblock.free_inode_count++;
+    superblock_dirty = 1;
+    log_debug("[DEBUG] Freed inode %d", inum);
+}
+
+// Writes the superblock back to block 0 if it has changed.
+// Returns 0 on success, -1 on failure.
+static int save_superblock() {
+    if (!superblock_dirty) return 0;
+    char block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    memset(block, 0, superblock.block_size);
+    memcpy(block, &superblock, sizeof(superblock));
+    if (disk_write(0, block) != 0) return -1;
+    superblock_dirty = 0;
+    return 0;
+}
+
+// --- Block mapping ---
+
+// Returns the bytes of an inline inode's contents, which overlay its block pointers
+static uint8_t *inode_inline_data(Inode *inode) {
+    return (uint8_t *)inode + offsetof(Inode, direct_blocks);
+}
+
+// Number of block pointers that fit in one indirect block
+static uint32_t ptrs_per_block() {
+    return superblock.block_size / sizeof(uint32_t);
+}
+
+// Number of logical blocks an inode can map
+static uint64_t max_file_blocks() {
+    uint64_t p = ptrs_per_block();
+    return MAX_DIRECT_POINTERS + p + p * p;
+}
+
+// Small cache of recently read indirect blocks. A sequential walk through a
+// file reuses the same indirect (and double-indirect) block for many lookups.
+#define MAP_CACHE_SIZE 4
+
+static struct {
+    uint32_t block;     // Physical block held, or 0 if the entry is empty
+    unsigned long used; // Last use, for LRU replacement
+    uint32_t ptrs[MAX_BLOCK_SIZE / sizeof(uint32_t)];
+} map_cache[MAP_CACHE_SIZE];
+
+static unsigned long map_cache_clock = 0;
+
+// Returns the pointers stored in indirect block, reading it through the cache.
+// Returns NULL on failure.
+static const uint32_t *map_cache_get(uint32_t block) {
+    int victim = 0;
+    for (int i = 0; i < MAP_CACHE_SIZE; i++) {
+        if (map_cache[i].block == block) {
+            map_cache[i].used = ++map_cache_clock;
+            return map_cache[i].ptrs;
+        }
+        if (map_cache[i].used < map_cache[victim].used) victim = i;
+    }
+
+    if (disk_read((int)block, map_cache[victim].ptrs) != 0) {
+        map_cache[victim].block = 0;
+        return NULL;
+    }
+    map_cache[victim].block = block;
+    map_cache[victim].used = ++map_cache_clock;
+    return map_cache[victim].ptrs;
+}
+
+// Drops an indirect block from the cache after it was freed or rewritten
+static void map_cache_invalidate(uint32_t block) {
+    for (int i = 0; i < MAP_CACHE_SIZE; i++) {
+        if (map_cache[i].block == block) map_cache[i].block = 0;
+    }
+}
+
+// Largest number of extents an extent-mapped inode can hold: the ones stored
+// in the inode plus one overflow block full of them
+static uint32_t max_extents() {
+    return INODE_INLINE_EXTENTS + superblock.block_size / sizeof(Extent);
+}
+
+// Reads extent i of an extent-mapped inode. The first INODE_INLINE_EXTENTS are
+// kept as (start, length) pairs in direct_blocks; the rest live in the overflow
+// block named by indirect_block. An extent of length 0 ends the list.
+// Returns 0 on success, -1 if i is out of range or the overflow block cannot be read.
+static int inode_get_extent(const Inode *inode, uint32_t i, Extent *ext) {
+    if (i >= max_extents()) return -1;
+    if (i < INODE_INLINE_EXTENTS) {
+        ext->start = inode->direct_blocks[2 * i];
+        ext->length = inode->direct_blocks[2 * i + 1];
+        return 0;
+    }
+
+    ext->start = ext->length = 0;
+    if (inode->indirect_block == 0) return 0;
+    const uint32_t *ptrs = map_cache_get(inode->indirect_block);
+    if (!ptrs) return -1;
+    i -= INODE_INLINE_EXTENTS;
+    ext->start = ptrs[2 * i];
+    ext->length = ptrs[2 * i + 1];
+    return 0;
+}
+
+// Splits blocks[0..count-1] into runs of consecutive block numbers.
+// Stores up to max runs in out (if not NULL) and returns the total number of runs.
+static uint32_t blocks_to_extents(const uint32_t *blocks, uint32_t count, Extent *out, uint32_t max) {
+    uint32_t runs = 0;
+    for (uint32_t i = 0; i < count; runs++) {
+        uint32_t n = 1;
+        while (i + n < count && blocks[i + n] == blocks[i] + n) n++;
+        if (out && runs < max) {
+            out[runs].start = blocks[i];
+            out[runs].length = n;
+        }
+        i += n;
+    }
+    return runs;
+}
+
+// Records blocks[0..count-1] in an inode without any blocks as extents,
+// allocating an overflow block if they do not fit in the inode.
+// Returns 0 on success, -1 if there are too many extents or on failure.
+static int inode_assign_extents(Inode *inode, const uint32_t *blocks, uint32_t count) {
+    Extent ext[INODE_INLINE_EXTENTS + MAX_BLOCK_SIZE / sizeof(Extent)];
+    uint32_t runs = blocks_to_extents(blocks, count, ext, max_extents());
+    if (runs > max_extents()) return -1;
+
+    memset(inode->direct_blocks, 0, sizeof(inode->direct_blocks));
+    for (uint32_t i = 0; i < runs && i < INODE_INLINE_EXTENTS; i++) {
+        inode->direct_blocks[2 * i] = ext[i].start;
+        inode->direct_blocks[2 * i + 1] = ext[i].length;
+    }
+
+    if (runs > INODE_INLINE_EXTENTS) {
+        int overflow = allocate_block();
+        if (overflow < 0) {
+            memset(inode->direct_blocks, 0, sizeof(inode->direct_blocks));
+            return -1;
+        }
+
+        uint32_t ptrs[MAX_BLOCK_SIZE / sizeof(uint32_t)] DISK_ALIGNED;
+        memset(ptrs, 0, superblock.block_size);
+        memcpy(ptrs, ext + INODE_INLINE_EXTENTS, (runs - INODE_INLINE_EXTENTS) * sizeof(Extent));
+        if (disk_write(overflow, ptrs) != 0) {
+            free_block(overflow);
+            memset(inode->direct_blocks, 0, sizeof(inode->direct_blocks));
+            return -1;
+        }
+        map_cache_invalidate((uint32_t)overflow);
+        inode->indirect_block = (uint32_t)overflow;
+    }
+
+    inode->flags |= INODE_FLAG_EXTENTS;
+    return 0;
+}
+
+// Maps logical block 'logical' of an inode to its physical block through the
+// direct, single-indirect and double-indirect pointers. *phys is 0 for a hole.
+// Returns 0 on success, -1 if the block is out of range or an indirect block
+// cannot be read.
+static int inode_bmap(const Inode *inode, uint32_t logical, uint32_t *phys) {
+    uint32_t p = ptrs_per_block();
+    *phys = 0;
+
+    if (inode->flags & INODE_FLAG_INLINE) return 0; // No blocks at all
+
+    if (inode->flags & INODE_FLAG_EXTENTS) {
+        Extent ext;
+        for (uint32_t i = 0; inode_get_extent(inode, i, &ext) == 0 && ext.length > 0; i++) {
+            if (logical < ext.length) {
+                *phys = ext.start + logical;
+                return 0;
+            }
+            logical -= ext.length;
+        }
+        return 0; // Past the last extent
+    }
+
+    if (logical < MAX_DIRECT_POINTERS) {
+        *phys = inode->direct_blocks[logical];
+        return 0;
+    }
+
+    logical -= MAX_DIRECT_POINTERS;
+    if (logical < p) {
+        if (inode->indirect_block == 0) return 0;
+        const uint32_t *ptrs = map_cache_get(inode->indirect_block);
+        if (!ptrs) return -1;
+        *phys = ptrs[logical];
+        return 0;
+    }
+
+    logical -= p;
+    if ((uint64_t)logical >= (uint64_t)p * p) return -1;
+    if (inode->double_indirect_block == 0) return 0;
+    const uint32_t *outer = map_cache_get(inode->double_indirect_block);
+    if (!outer) return -1;
+    uint32_t leaf = outer[logical / p];
+    if (leaf == 0) return 0;
+    const uint32_t *ptrs = map_cache_get(leaf);
+    if (!ptrs) return -1;
+    *phys = ptrs[logical % p];
+    return 0;
+}
+
+// Number of indirect blocks needed to map count logical blocks
+static uint32_t indirect_blocks_needed(uint32_t count) {
+    uint32_t p = ptrs_per_block();
+    if (count <= MAX_DIRECT_POINTERS) return 0;
+    count -= MAX_DIRECT_POINTERS;
+    if (count <= p) return 1;
+    count -= p;
+    return 2 + (count + p - 1) / p; // Single, double and its leaves
+}
+
+// Points logical blocks 0..count-1 of an inode without any blocks at blocks[].
+// Indirect blocks are allocated and written as needed.
+// Returns 0 on success, -1 on failure (nothing stays allocated).
+static int inode_assign_blocks(Inode *inode, const uint32_t *blocks, uint32_t count) {
+    uint32_t p = ptrs_per_block();
+    uint32_t nmeta = indirect_blocks_needed(count);
+    uint32_t meta[2 + MAX_BLOCK_SIZE / sizeof(uint32_t)];
+    if (nmeta > 0 && allocate_blocks(nmeta, meta) != 0) return -1;
+
+    uint32_t direct = count < MAX_DIRECT_POINTERS ? count : MAX_DIRECT_POINTERS;
+    memcpy(inode->direct_blocks, blocks, direct * sizeof(uint32_t));
+    if (nmeta == 0) return 0;
+
+    uint32_t ptrs[MAX_BLOCK_SIZE / sizeof(uint32_t)] DISK_ALIGNED;
+    uint32_t done = direct;
+    uint32_t n = count - done < p ? count - done : p;
+
+    // Single-indirect block
+    memset(ptrs, 0, superblock.block_size);
+    memcpy(ptrs, blocks + done, n * sizeof(uint32_t));
+    if (disk_write((int)meta[0], ptrs) != 0) goto fail;
+    inode->indirect_block = meta[0];
+    map_cache_invalidate(meta[0]);
+    done += n;
+    if (nmeta == 1) return 0;
+
+    // Double-indirect block and its leaves
+    uint32_t outer[MAX_BLOCK_SIZE / sizeof(uint32_t)] DISK_ALIGNED;
+    memset(outer, 0, superblock.block_size);
+    for (uint32_t leaf = 0; done < count; leaf++) {
+        n = count - done < p ? count - done : p;
+        memset(ptrs, 0, superblock.block_size);
+        memcpy(ptrs, blocks + done, n * sizeof(uint32_t));
+        if (disk_write((int)meta[2 + leaf], ptrs) != 0) goto fail;
+        map_cache_invalidate(meta[2 + leaf]);
+        outer[leaf] = meta[2 + leaf];
+        done += n;
+    }
+    if (disk_write((int)meta[1], outer) != 0) goto fail;
+    map_cache_invalidate(meta[1]);
+    inode->double_indirect_block = meta[1];
+    return 0;
+
+fail:
+    for (uint32_t i = 0; i < nmeta; i++) free_block((int)meta[i]);
+    memset(inode->direct_blocks, 0, sizeof(inode->direct_blocks));
+    inode->indirect_block = 0;
+    inode->double_indirect_block = 0;
+    return -1;
+}
+
+// Frees the data blocks past the first keep mapped under an indirect block of
+// the given depth (1 = single, 2 = double), along with any indirect blocks left
+// empty. *slot is cleared once nothing under it is kept.
+// Returns 0 on success, -1 if an indirect block cannot be read or written.
+static int trim_indirect(uint32_t *slot, uint32_t keep, int depth) {
+    if (*slot == 0) return 0;
+    uint32_t p = ptrs_per_block();
+    uint32_t span = depth == 1 ? 1 : p; // Data blocks mapped under each pointer
+    uint32_t ptrs[MAX_BLOCK_SIZE / sizeof(uint32_t)] DISK_ALIGNED;
+    if (disk_read((int)*slot, ptrs) != 0) return -1;
+
+    int changed = 0;
+    for (uint32_t i = keep / span; i < p; i++) {
+        if (ptrs[i] == 0) continue;
+        if (depth == 1) {
+            free_block((int)ptrs[i]);
+            ptrs[i] = 0;
+        } else if (trim_indirect(&ptrs[i], keep > i * span ? keep - i * span : 0, 1) != 0) {
+            return -1;
+        }
+        changed |= ptrs[i] == 0;
+    }
+
+    if (keep == 0) {
+        map_cache_invalidate(*slot);
+        free_block((int)*slot);
+        *slot = 0;
+    } else if (changed) {
+        map_cache_invalidate(*slot);
+        if (disk_write((int)*slot, ptrs) != 0) return -1;
+    }
+    return 0;
+}
+
+// Frees all data and indirect blocks of an inode and clears its pointers.
+// The size is left for the caller to update.
+static void inode_truncate(Inode *inode) {
+    if (inode->flags & INODE_FLAG_INLINE) {
+        memset(inode_inline_data(inode), 0, INODE_INLINE_SIZE);
+        inode->flags &= ~INODE_FLAG_INLINE;
+        return;
+    }
+
+    if (inode->flags & INODE_FLAG_EXTENTS) {
+        Extent ext;
+        for (uint32_t i = 0; inode_get_extent(inode, i, &ext) == 0 && ext.length > 0; i++) {
+            for (uint32_t b = 0; b < ext.length; b++) free_block((int)(ext.start + b));
+        }
+        if (inode->indirect_block != 0) {
+            map_cache_invalidate(inode->indirect_block);
+            free_block((int)inode->indirect_block);
+        }
+        memset(inode->direct_blocks, 0, sizeof(inode->direct_blocks));
+        inode->indirect_block = 0;
+        inode->flags &= ~INODE_FLAG_EXTENTS;
+        return;
+    }
+
+    for (int i = 0; i < MAX_DIRECT_POINTERS; i++) {
+        if (inode->direct_blocks[i] != 0) free_block((int)inode->direct_blocks[i]);
+        inode->direct_blocks[i] = 0;
+    }
+    trim_indirect(&inode->indirect_block, 0, 1);
+    trim_indirect(&inode->double_indirect_block, 0, 2);
+}
+
+// Cuts a block- or extent-mapped inode down to its first new_blocks data
+// blocks, freeing only the blocks past that point. The size is left for the
+// caller to update. Returns 0 on success, -1 on failure.
+static int inode_shrink(Inode *inode, uint32_t new_blocks) {
+    if (new_blocks == 0) {
+        inode_truncate(inode);
+        return 0;
+    }
+
+    if (inode->flags & INODE_FLAG_EXTENTS) {
+        Extent ext[INODE_INLINE_EXTENTS + MAX_BLOCK_SIZE / sizeof(Extent)];
+        uint32_t n = 0;
+        while (n < max_extents() && inode_get_extent(inode, n, &ext[n]) == 0 && ext[n].length > 0) n++;
+
+        // Keep the extents covering the first new_blocks, cutting the last one short
+        uint32_t keep = 0, covered = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t from = covered < new_blocks ? new_blocks - covered : 0;
+            if (from > ext[i].length) from = ext[i].length;
+            for (uint32_t b = from; b < ext[i].length; b++) free_block((int)(ext[i].start + b));
+            covered += ext[i].length;
+            ext[i].length = from;
+            if (from > 0) keep = i + 1;
+        }
+
+        for (uint32_t i = 0; i < INODE_INLINE_EXTENTS; i++) {
+            inode->direct_blocks[2 * i] = i < keep ? ext[i].start : 0;
+            inode->direct_blocks[2 * i + 1] = i < keep ? ext[i].length : 0;
+        }
+
+        if (inode->indirect_block != 0) {
+            map_cache_invalidate(inode->indirect_block);
+            if (keep <= INODE_INLINE_EXTENTS) {
+                free_block((int)inode->indirect_block); // Overflow block no longer needed
+                inode->indirect_block = 0;
+            } else {
+                uint32_t ptrs[MAX_BLOCK_SIZE / sizeof(uint32_t)] DISK_ALIGNED;
+                memset(ptrs, 0, superblock.block_size);
+                memcpy(ptrs, ext + INODE_INLINE_EXTENTS, (keep - INODE_INLINE_EXTENTS) * sizeof(Extent));
+                if (disk_write((int)inode->indirect_block, ptrs) != 0) return -1;
+            }
+        }
+        return 0;
+    }
+
+    for (uint32_t i = new_blocks; i < MAX_DIRECT_POINTERS; i++) {
+        if (inode->direct_blocks[i] != 0) free_block((int)inode->direct_blocks[i]);
+        inode->direct_blocks[i] = 0;
+    }
+    uint32_t p = ptrs_per_block();
+    uint32_t past_direct = new_blocks > MAX_DIRECT_POINTERS ? new_blocks - MAX_DIRECT_POINTERS : 0;
+    if (trim_indirect(&inode->indirect_block, past_direct, 1) != 0) return -1;
+    return trim_indirect(&inode->double_indirect_block, past_direct > p ? past_direct - p : 0, 2);
+}
+
+// --- File data ---
+
+// Number of blocks needed to hold size bytes
+static uint32_t size_to_blocks(uint64_t size) {
+    return (uint32_t)((size + superblock.block_size - 1) / superblock.block_size);
+}
+
+// Largest file size in bytes; sizes are returned as int
+static uint64_t max_file_size() {
+    uint64_t max_size = max_file_blocks() * superblock.block_size;
+    return max_size > INT32_MAX ? INT32_MAX : max_size;
+}
+
+// Appends blocks to the extent list of an extent-mapped inode, merging with the
+// last extent when contiguous.
+// Returns 0 on success, -1 if the extents no longer fit or on failure.
+static int inode_append_extents(Inode *inode, const uint32_t *blocks, uint32_t count) {
+    Extent ext[INODE_INLINE_EXTENTS + MAX_BLOCK_SIZE / sizeof(Extent)];
+    uint32_t n = 0;
+    while (n < max_extents() && inode_get_extent(inode, n, &ext[n]) == 0 && ext[n].length > 0) n++;
+
+    for (uint32_t i = 0; i < count;) {
+        uint32_t len = 1;
+        while (i + len < count && blocks[i + len] == blocks[i] + len) len++;
+        if (n > 0 && ext[n - 1].start + ext[n - 1].length == blocks[i]) {
+            ext[n - 1].length += len;
+        } else {
+            if (n == max_extents()) return -1;
+            ext[n].start = blocks[i];
+            ext[n].length = len;
+            n++;
+        }
+        i += len;
+    }
+
+    // Everything still fits; store the list back
+    uint32_t old_direct[MAX_DIRECT_POINTERS];
+    uint32_t old_overflow = inode->indirect_block;
+    memcpy(old_direct, inode->direct_blocks, sizeof(old_direct));
+    if (n > INODE_INLINE_EXTENTS && inode->indirect_block == 0) {
+        int overflow = allocate_block();
+        if (overflow < 0) return -1;
+        inode->indirect_block = (uint32_t)overflow;
+    }
+    for (uint32_t i = 0; i < INODE_INLINE_EXTENTS; i++) {
+        inode->direct_blocks[2 * i] = i < n ? ext[i].start : 0;
+        inode->direct_blocks[2 * i + 1] = i < n ? ext[i].length : 0;
+    }
+    if (inode->indirect_block != 0) {
+        uint32_t ptrs[MAX_BLOCK_SIZE / sizeof(uint32_t)] DISK_ALIGNED;
+        memset(ptrs, 0, superblock.block_size);
+        if (n > INODE_INLINE_EXTENTS) {
+            memcpy(ptrs, ext + INODE_INLINE_EXTENTS, (n - INODE_INLINE_EXTENTS) * sizeof(Extent));
+        }
+        map_cache_invalidate(inode->indirect_block);
+        if (disk_write((int)inode->indirect_block, ptrs) != 0) {
+            // Leave the inode with the list it had
+            if (old_overflow == 0) free_block((int)inode->indirect_block);
+            inode->indirect_block = old_overflow;
+            memcpy(inode->direct_blocks, old_direct, sizeof(old_direct));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Makes sure *slot names an indirect block, allocating a zeroed one if needed.
+// Returns 0 on success, -1 on failure.
+static int ensure_indirect(uint32_t *slot) {
+    if (*slot != 0) return 0;
+    int block = allocate_block();
+    if (block < 0) return -1;
+
+    uint32_t zeros[MAX_BLOCK_SIZE / sizeof(uint32_t)] DISK_ALIGNED;
+    memset(zeros, 0, superblock.block_size);
+    if (disk_write(block, zeros) != 0) {
+        free_block(block);
+        return -1;
+    }
+    map_cache_invalidate((uint32_t)block);
+    *slot = (uint32_t)block;
+    return 0;
+}
+
+// Points logical blocks first..first+count-1 of a block-mapped inode at blocks[],
+// allocating indirect blocks as needed. Each indirect block touched is read and
+// written once. Returns 0 on success, -1 on failure.
+static int inode_map_blocks(Inode *inode, uint32_t first, const uint32_t *blocks, uint32_t count) {
+    uint32_t p = ptrs_per_block();
+    uint32_t ptrs[MAX_BLOCK_SIZE / sizeof(uint32_t)] DISK_ALIGNED;
+
+    for (uint32_t i = 0; i < count;) {
+        uint32_t logical = first + i;
+        if (logical < MAX_DIRECT_POINTERS) {
+            inode->direct_blocks[logical] = blocks[i++];
+            continue;
+        }
+
+        uint32_t target, index;
+        logical -= MAX_DIRECT_POINTERS;
+        if (logical < p) {
+            if (ensure_indirect(&inode->indirect_block) != 0) return -1;
+            target = inode->indirect_block;
+            index = logical;
+        } else {
+            logical -= p;
+            if (ensure_indirect(&inode->double_indirect_block) != 0) return -1;
+            if (disk_read((int)inode->double_indirect_block, ptrs) != 0) return -1;
+            uint32_t leaf = ptrs[logical / p];
+            if (leaf == 0) {
+                if (ensure_indirect(&leaf) != 0) return -1;
+                ptrs[logical / p] = leaf;
+                map_cache_invalidate(inode->double_indirect_block);
+                if (disk_write((int)inode->double_indirect_block, ptrs) != 0) return -1;
+            }
+            target = leaf;
+            index = logical % p;
+        }
+
+        uint32_t n = count - i < p - index ? count - i : p - index;
+        if (disk_read((int)target, ptrs) != 0) return -1;
+        memcpy(ptrs + index, blocks + i, n * sizeof(uint32_t));
+        map_cache_invalidate(target);
+        if (disk_write((int)target, ptrs) != 0) return -1;
+        i += n;
+    }
+    return 0;
+}
+
+// Switches an extent-mapped inode to block pointers, mapping its current blocks
+// followed by blocks[0..count-1]. Returns 0 on success, -1 on failure.
+static int inode_extents_to_blocks(Inode *inode, uint32_t old_blocks, const uint32_t *blocks, uint32_t count) {
+    uint32_t *all = malloc(((size_t)old_blocks + count) * sizeof(*all));
+    if (!all) return -1;
+    for (uint32_t i = 0; i < old_blocks; i++) {
+        if (inode_bmap(inode, i, &all[i]) != 0) {
+            free(all);
+            return -1;
+        }
+    }
+    memcpy(all + old_blocks, blocks, count * sizeof(*all));
+
+    // Map the blocks afresh, keeping the extent list until that has worked
+    uint32_t old_direct[MAX_DIRECT_POINTERS];
+    uint32_t overflow = inode->indirect_block;
+    memcpy(old_direct, inode->direct_blocks, sizeof(old_direct));
+    memset(inode->direct_blocks, 0, sizeof(inode->direct_blocks));
+    inode->indirect_block = 0;
+    inode->flags &= ~INODE_FLAG_EXTENTS;
+
+    int result = inode_assign_blocks(inode, all, old_blocks + count);
+    free(all);
+    if (result != 0) {
+        memcpy(inode->direct_blocks, old_direct, sizeof(old_direct));
+        inode->indirect_block = overflow;
+        inode->flags |= INODE_FLAG_EXTENTS;
+        return -1;
+    }
+
+    // Drop the old extent list but not the data blocks it names
+    if (overflow != 0) {
+        map_cache_invalidate(overflow);
+        free_block((int)overflow);
+    }
+    return 0;
+}
+
+// Extends a block- or extent-mapped inode from old_blocks to new_blocks data
+// blocks. New blocks are placed right after the current last block when that
+// space is free. Returns 0 on success, -1 on failure (nothing new is kept).
+static int inode_grow(Inode *inode, uint32_t old_blocks, uint32_t new_blocks) {
+    if (new_blocks <= old_blocks) return 0;
+    uint32_t count = new_blocks - old_blocks;
+
+    uint32_t last;
+    if (old_blocks > 0 && inode_bmap(inode, old_blocks - 1, &last) == 0 && last != 0) {
+        alloc_hint = last + 1 - superblock.data_start; // Aim for a contiguous extension
+    }
+
+    uint32_t *blocks = malloc(count * sizeof(*blocks));
+    if (!blocks || allocate_blocks(count, blocks) != 0) {
+        free(blocks);
+        return -1;
+    }
+
+    int result;
+    if (old_blocks == 0 && !(inode->flags & INODE_FLAG_EXTENTS) &&
+        inode->indirect_block == 0 && inode->double_indirect_block == 0) {
+        // Nothing mapped yet: prefer extents, as write_fs does
+        result = inode_assign_extents(inode, blocks, count) == 0 ? 0
+               : inode_assign_blocks(inode, blocks, count);
+    } else if (inode->flags & INODE_FLAG_EXTENTS) {
+        result = inode_append_extents(inode, blocks, count) == 0 ? 0
+               : inode_extents_to_blocks(inode, old_blocks, blocks, count);
+    } else {
+        result = inode_map_blocks(inode, old_blocks, blocks, count);
+        // Unmap what was mapped before the failure, with any indirect blocks
+        // allocated for it
+        if (result != 0) inode_shrink(inode, old_blocks);
+    }
+
+    if (result != 0) {
+        for (uint32_t i = 0; i < count; i++) free_block((int)blocks[i]);
+    }
+    free(blocks);
+    return result;
+}
+
+// Writes len bytes at offset into the mapped blocks of an inode, with one
+// vectored call. Whole blocks go straight from data; a partial block at either
+// edge is read, patched and written back, except that blocks from logical
+// block fresh_from on are new and start out as zeros. A NULL data writes zeros.
+// Returns 0 on success, -1 on failure.
+static int inode_write_range(const Inode *inode, const void *data, size_t offset, size_t len, uint32_t fresh_from) {
+    if (len == 0) return 0;
+    uint32_t block_size = superblock.block_size;
+    uint32_t first = (uint32_t)(offset / block_size);
+    uint32_t last = (uint32_t)((offset + len - 1) / block_size);
+    static const char zero_block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    char edge[2][MAX_BLOCK_SIZE] DISK_ALIGNED;
+    int edges = 0;
+
+    DiskIoVec *vec = malloc((size_t)(last - first + 1) * sizeof(*vec));
+    if (!vec) return -1;
+
+    int result = 0;
+    for (uint32_t b = first; b <= last && result == 0; b++) {
+        size_t block_start = (size_t)b * block_size;
+        size_t from = offset > block_start ? offset - block_start : 0;
+        size_t to = offset + len - block_start < block_size ? offset + len - block_start : block_size;
+        const char *src = data ? (const char *)data + (block_start + from - offset) : NULL;
+
+        uint32_t phys;
+        if (inode_bmap(inode, b, &phys) != 0 || phys == 0) {
+            result = -1;
+            break;
+        }
+        vec[b - first].block_num = (int)phys;
+
+        if (from == 0 && to == block_size) {
+            vec[b - first].buf = (void *)(src ? src : zero_block); // disk_writev only reads from it
+            continue;
+        }
+
+        // Unaligned edge: read-modify-write
+        char *buf = edge[edges++];
+        if (b >= fresh_from) memset(buf, 0, block_size);
+        else if (disk_read((int)phys, buf) != 0) result = -1;
+        if (src) memcpy(buf + from, src, to - from);
+        else memset(buf + from, 0, to - from);
+        vec[b - first].buf = buf;
+    }
+
+    if (result == 0) result = disk_writev(vec, (int)(last - first + 1));
+    free(vec);
+    return result;
+}
+
+// Reads the first size bytes of an extent-mapped inode into buffer with one
+// multi-block read per extent. Only a final partial block goes through scratch.
+// Returns 0 on success, -1 on failure.
+static int read_extents(const Inode *inode, void *buffer, size_t size) {
+    uint32_t block_size = superblock.block_size;
+    char tail[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    size_t offset = 0;
+    Extent ext;
+
+    for (uint32_t i = 0; offset < size; i++) {
+        if (inode_get_extent(inode, i, &ext) != 0) return -1;
+        if (ext.length == 0) break;
+
+        size_t left = size - offset;
+        uint32_t whole = (uint32_t)(left / block_size);
+        if (whole > ext.length) whole = ext.length;
+        if (whole > 0 &&
+            disk_read_blocks((int)ext.start, (int)whole, (char *)buffer + offset) != 0) return -1;
+        offset += (size_t)whole * block_size;
+
+        if (whole < ext.length && offset < size) {
+            if (disk_read((int)(ext.start + whole), tail) != 0) return -1;
+            memcpy((char *)buffer + offset, tail, size - offset);
+            offset = size;
+        }
+    }
+
+    if (offset < size) memset((char *)buffer + offset, 0, size - offset); // Unmapped tail
+    return 0;
+}
+
+// Reads len bytes at offset from an inode into buffer; the range must lie
+// within the file. Whole blocks land directly in the caller's buffer and only
+// partial edge blocks go through scratch. Holes read back as zeros.
+// Returns 0 on success, -1 on failure.
+static int inode_read_range(Inode *inode, void *buffer, size_t offset, size_t len) {
+    if (len == 0) return 0;
+    if (inode->flags & INODE_FLAG_INLINE) {
+        memcpy(buffer, inode_inline_data(inode) + offset, len); // Already in the inode
+        return 0;
+    }
+    if ((inode->flags & INODE_FLAG_EXTENTS) && offset == 0) {
+        return read_extents(inode, buffer, len);
+    }
+
+    uint32_t block_size = superblock.block_size;
+    uint32_t first = (uint32_t)(offset / block_size);
+    uint32_t last = (uint32_t)((offset + len - 1) / block_size);
+    char edge[2][MAX_BLOCK_SIZE] DISK_ALIGNED;
+    struct { char *dst; const char *src; size_t n; } copy[2];
+    int edges = 0;
+
+    DiskIoVec *vec = malloc((size_t)(last - first + 1) * sizeof(*vec));
+    if (!vec) return -1;
+
+    int count = 0;
+    for (uint32_t b = first; b <= last; b++) {
+        size_t block_start = (size_t)b * block_size;
+        size_t from = offset > block_start ? offset - block_start : 0;
+        size_t to = offset + len - block_start < block_size ? offset + len - block_start : block_size;
+        char *dst = (char *)buffer + (block_start + from - offset);
+
+        uint32_t phys;
+        if (inode_bmap(inode, b, &phys) != 0) {
+            free(vec);
+            return -1;
+        }
+        if (phys == 0) {
+            memset(dst, 0, to - from);
+            continue;
+        }
+
+        vec[count].block_num = (int)phys;
+        if (from == 0 && to == block_size) {
+            vec[count++].buf = dst;
+            continue;
+        }
+        vec[count++].buf = edge[edges];
+        copy[edges].dst = dst;
+        copy[edges].src = edge[edges] + from;
+        copy[edges].n = to - from;
+        edges++;
+    }
+
+    int result = count > 0 ? disk_readv(vec, count) : 0; // The range may be all holes
+    free(vec);
+    for (int i = 0; i < edges && result == 0; i++) memcpy(copy[i].dst, copy[i].src, copy[i].n);
+    return result;
+}
+
+// Writes size bytes at offset into the file with inode number inum, growing it
+// as needed. Only the blocks in the range are written; bytes between the old
+// end of file and offset become zeros. Updates and saves the inode.
+// Returns the number of bytes written, or -1 on failure.
+static int inode_pwrite(int inum, Inode *inode, const void *data, size_t size, size_t offset) {
+    if ((uint64_t)offset + size > max_file_size()) {
+        fprintf(stderr, "pwrite_fs: File size too large (max is %llu bytes)\n",
+                (unsigned long long)max_file_size());
+        return -1;
+    }
+    if (size == 0) return 0;
+
+    size_t old_size = inode->size;
+    size_t new_size = offset + size > old_size ? offset + size : old_size;
+    int mapped = inode->size > 0 || (inode->flags & INODE_FLAG_EXTENTS);
+
+    // Small files stay inside the inode
+    if (new_size <= INODE_INLINE_SIZE && (!mapped || (inode->flags & INODE_FLAG_INLINE))) {
+        uint8_t *inline_data = inode_inline_data(inode);
+        if (!(inode->flags & INODE_FLAG_INLINE)) memset(inline_data, 0, INODE_INLINE_SIZE);
+        memcpy(inline_data + offset, data, size); // Any gap is already zero
+        inode->flags |= INODE_FLAG_INLINE;
+        inode->size = (uint32_t)new_size;
+        return write_inode(inum, inode) == 0 ? (int)size : -1;
+    }
+
+    // Growing out of the inode: move the inline bytes to a real block first
+    uint8_t moved[INODE_INLINE_SIZE];
+    size_t moved_len = 0;
+    if (inode->flags & INODE_FLAG_INLINE) {
+        moved_len = old_size;
+        memcpy(moved, inode_inline_data(inode), moved_len);
+        inode_truncate(inode);
+        old_size = 0;
+    }
+
+    uint32_t old_blocks = size_to_blocks(old_size);
+    uint32_t kept_blocks = old_blocks; // Blocks mapped before this write
+    if (inode_grow(inode, old_blocks, size_to_blocks(new_size)) != 0) {
+        fprintf(stderr, "pwrite_fs: No free data block available\n");
+        if (moved_len > 0) {
+            memcpy(inode_inline_data(inode), moved, moved_len); // Put it back
+            inode->flags |= INODE_FLAG_INLINE;
+        }
+        return -1;
+    }
+
+    int result = inode_write_range(inode, moved, 0, moved_len, old_blocks);
+    if (moved_len > 0) {
+        old_size = moved_len;
+        old_blocks = size_to_blocks(moved_len); // That block now holds data
+    }
 
-    int inodes_per_block = BLOCK_SIZE / sizeof(Inode);
-    int block = INODE_START + inum / inodes_per_block;
-    int offset = inum % inodes_per_block;
+    // Zero the gap between the old end of file and the write in one call
+    if (result == 0 && offset > old_size) {
+        result = inode_write_range(inode, NULL, old_size, offset - old_size, old_blocks);
+    }
 
-    if (block < INODE_START || block >= INODE_START + INODE_BLOCKS) {
-        fprintf(stderr, "read_inode: Block %d is outside inode table!\n", block);
+    if (result == 0) result = inode_write_range(inode, data, offset, size, old_blocks);
+    if (result == 0) {
+        inode->size = (uint32_t)new_size;
+        result = write_inode(inum, inode);
+    }
+    if (result != 0) {
+        fprintf(stderr, "pwrite_fs: Error writing data blocks\n");
+        // Give back the blocks this write added and restore the old contents
+        inode_shrink(inode, kept_blocks);
+        inode->size = (uint32_t)(moved_len > 0 ? moved_len : old_size);
+        if (moved_len > 0) {
+            memcpy(inode_inline_data(inode), moved, moved_len);
+            inode->flags |= INODE_FLAG_INLINE;
+        }
         return -1;
     }
+    return (int)size;
+}
 
-    Inode *inodes = malloc(BLOCK_SIZE);
-    if (!inodes) {
-        fprintf(stderr, "read_inode: Memory allocation failed!\n");
+// Create a new filesystem on the disk
+
+int mkfs_fs(const char *disk_path, uint32_t block_size, uint32_t block_count) {
+    // 1. Validate the geometry and lay out superblock, bitmap, inode table and data
+    if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE || (block_size & (block_size - 1))) {
+        fprintf(stderr, "mkfs_fs: Block size must be a power of two between %d and %d\n",
+                MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
         return -1;
     }
 
-    if (disk_read(block, inodes) != 0) {
-        fprintf(stderr, "Failed to read inode block %d\n", block);
-        free(inodes);
+    if (block_count > INT32_MAX) {
+        fprintf(stderr, "mkfs_fs: %u blocks is too large for a filesystem\n", block_count);
         return -1;
     }
 
-    *inode = inodes[offset];
+    // The bitmap gets one block per block_size * 8 blocks of the image, which
+    // always covers the data blocks that follow the metadata
+    uint32_t bitmap_block_count = (block_count + block_size * 8 - 1) / (block_size * 8);
+
+    SuperBlock sb;
+    sb.magic = MAGIC_NUMBER;
+    sb.block_size = block_size;
+    sb.fs_size_blocks = block_count;
+    sb.inode_start = BITMAP_BLOCK + bitmap_block_count;
+    sb.inode_count = block_count / BLOCKS_PER_INODE;
+    sb.data_start = sb.inode_start + inode_table_blocks(sb.inode_count, block_size);
+    sb.version = FS_VERSION;
+    sb.free_inode_count = sb.inode_count - 1; // Everything but the root
+    sb.free_inode_head = sb.free_inode_count > 0 ? ROOT_INODE + 1 : NO_INODE;
+
+    if (sb.inode_count == 0 || sb.data_start >= block_count) {
+        fprintf(stderr, "mkfs_fs: %u blocks is too small for a filesystem\n", block_count);
+        return -1;
+    }
+
+    // 2. Create the disk image at its full size. Writing only the last byte
+    // leaves the rest as a hole, which reads back as zeros.
+    FILE *f = fopen(disk_path, "wb");
+    if (!f) return -1;
+    if (fseek(f, (long)block_count * block_size - 1, SEEK_SET) != 0 || fputc(0, f) == EOF) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    // 3. Open the disk using your disk I/O abstraction
+    if (disk_open(disk_path) != 0) return -1;
+    if (disk_set_geometry(block_size, block_count) != 0) {
+        disk_close();
+        return -1;
+    }
+
+    // 4. Initialize inode 0 as root directory "/"
+    Inode root;
+    memset(&root, 0, sizeof(root));
+    root.is_valid = 1;
+    root.is_directory = 1;
+
+    // 5. Write the superblock (block 0), a zeroed bitmap (from block 1) and the
+    // inode table holding the root inode and the free inode list in one vectored call
+    char *meta = calloc(sb.data_start, block_size);
+    if (!meta) {
+        disk_close();
+        return -1;
+    }
+    memcpy(meta, &sb, sizeof(sb));
+    uint8_t *table = (uint8_t *)meta + (size_t)sb.inode_start * block_size;
+    *inode_slot(table, ROOT_INODE, block_size) = root;
+    for (uint32_t i = ROOT_INODE + 1; i < sb.inode_count; i++) {
+        FREE_INODE_NEXT(inode_slot(table, i, block_size)) = i + 1 < sb.inode_count ? i + 1 : NO_INODE;
+    }
+    int written = disk_write_blocks(0, (int)sb.data_start, meta);
+    free(meta);
+    if (written != 0) {
+        disk_close();
+        return -1;
+    }
+
+    disk_close();
+    return 0;
+}
+
+// Cache of directory lookups keyed by (parent directory inode, name). An entry
+// whose inum is NO_INODE records that the name does not exist, so repeated
+// misses skip the directory scan as well. Direct-mapped: an insert replaces
+// whatever shares its slot. Empty slots have an empty name.
+#define DENTRY_CACHE_SIZE 256
+
+static struct {
+    uint32_t parent; // Directory the name lives in
+    uint32_t inum;   // Inode the name maps to, or NO_INODE if it does not exist
+    char name[MAX_FILENAME_LEN + 1];
+} dentry_cache[DENTRY_CACHE_SIZE];
+
+// FNV-1a hash of (parent, name), reduced to a cache slot
+static uint32_t dentry_slot(uint32_t parent, const char *name) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 4; i++) hash = (hash ^ ((parent >> (8 * i)) & 0xff)) * 16777619u;
+    for (; *name; name++) hash = (hash ^ (uint8_t)*name) * 16777619u;
+    return hash % DENTRY_CACHE_SIZE;
+}
+
+// Looks up name in directory parent without touching the disk.
+// Returns 1 and sets *inum (NO_INODE for a cached miss) on a hit, 0 if not cached.
+static int dentry_lookup(uint32_t parent, const char *name, uint32_t *inum) {
+    uint32_t slot = dentry_slot(parent, name);
+    if (dentry_cache[slot].parent != parent || strcmp(dentry_cache[slot].name, name) != 0) return 0;
+    *inum = dentry_cache[slot].inum;
+    return 1;
+}
+
+// Records that name in directory parent maps to inum (NO_INODE if absent)
+static void dentry_insert(uint32_t parent, const char *name, uint32_t inum) {
+    uint32_t slot = dentry_slot(parent, name);
+    dentry_cache[slot].parent = parent;
+    dentry_cache[slot].inum = inum;
+    strncpy(dentry_cache[slot].name, name, MAX_FILENAME_LEN);
+    dentry_cache[slot].name[MAX_FILENAME_LEN] = '\0';
+}
+
+// Drops every entry inside a directory that has been removed, so its inode
+// number can be reused
+static void dentry_forget_dir(uint32_t dir) {
+    for (int i = 0; i < DENTRY_CACHE_SIZE; i++) {
+        if (dentry_cache[i].parent == dir) dentry_cache[i].name[0] = '\0';
+    }
+}
+
+int split_path(const char *path, char parts[][MAX_FILENAME_LEN + 1], int *count) {
+    if (!path || path[0] != '/' || !parts || !count) return -1;  // Validate all input
+
+    *count = 0;
+    const char *p = path + 1; // skip initial '/'
+
+    while (p && *p && *count < 64) {
+        const char *slash = strchr(p, '/');  // Find next '/'
+        size_t len = slash ? (size_t)(slash - p) : strlen(p);
+        if (len > MAX_FILENAME_LEN || len == 0) return -1;  // Check name length
+
+        strncpy(parts[*count], p, len);  // Copy the part
+        parts[*count][len] = '\0';       // Null-terminate
+        (*count)++;
+
+        p = slash ? slash + 1 : NULL;    // Move to next component
+    }
 
-    free(inodes);
     return 0;
 }
 
-int write_inode(int inum, Inode *inode) {
-    if (inum < 0 || inum >= INODE_COUNT) return -1;
-
-    int inodes_per_block = BLOCK_SIZE / sizeof(Inode);
-    int block = INODE_START + inum / inodes_per_block;
-    int offset = inum % inodes_per_block;
+// --- Directories ---
+//
+// Directory blocks hold variable-length DirRecord records packed back to back.
+// A record takes only the bytes its name needs, and any slack after it is
+// free space for a later insert. The last record of a block runs to its end,
+// and deleting a record folds its bytes into the record before it.
+//
+// A directory starts out unindexed, with its records in one block. Once that
+// is full it is converted to an indexed directory (INODE_FLAG_INDEXED):
+// logical block 0 becomes a DirIndex sorted by name hash, and the records
+// move to leaf blocks that each hold one hash range. A lookup, insert or
+// delete then reads the index block and a single leaf. When the root index
+// fills up, its entries move down into a second level of index blocks
+// (INODE_FLAG_INDEX2), which adds one block read per operation. The blocks of
+// an indexed directory are mapped like file blocks, so it grows through the
+// indirect pointers.
+
+// Bytes a record with a name of len characters takes, kept 4-byte aligned
+#define DIR_REC_SIZE(len) ((uint32_t)((sizeof(DirRecord) + (len) + 3) & ~(size_t)3))
+
+// Most records one directory block can hold
+#define DIR_MAX_RECORDS (MAX_BLOCK_SIZE / DIR_REC_SIZE(1))
+
+// Route from the root index of a directory down to the leaf for a hash
+typedef struct {
+    uint32_t pos[2]; // Entry taken in the root and in the index block below it
+    uint32_t node;   // Index block below the root, or 0 with a single level
+    uint32_t leaf;   // Leaf block holding the hash
+} DirPath;
+
+// A directory entry with the hash of its name, for sorting entries into leaves
+typedef struct {
+    uint32_t hash;
+    DirectoryEntry entry;
+} HashedEntry;
+
+// FNV-1a hash of a name, which picks its leaf in an indexed directory
+static uint32_t name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (; *name; name++) hash = (hash ^ (uint8_t)*name) * 16777619u;
+    return hash;
+}
+
+// qsort comparator ordering entries by name hash
+static int compare_hashed(const void *a, const void *b) {
+    uint32_t ha = ((const HashedEntry *)a)->hash, hb = ((const HashedEntry *)b)->hash;
+    return (ha > hb) - (ha < hb);
+}
+
+// Number of entries that fit in a DirIndex block
+static uint32_t dir_index_capacity() {
+    return (uint32_t)((superblock.block_size - sizeof(DirIndex)) / sizeof(DirIndexEntry));
+}
+
+// Position of the index entry whose leaf holds the names with this hash
+static uint32_t dir_index_find(const DirIndex *index, uint32_t hash) {
+    uint32_t lo = 0, hi = index->count; // The answer lies in [lo, hi)
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (index->entries[mid].hash <= hash) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Returns the record at byte offset off of a directory block
+static DirRecord *dir_record(const void *block, uint32_t off) {
+    return (DirRecord *)((char *)block + off);
+}
+
+// Offset of the record after the one at off, or the block size after the
+// last one. A damaged rec_len also ends the walk.
+static uint32_t dir_next(const void *block, uint32_t off) {
+    uint32_t len = dir_record(block, off)->rec_len;
+    if (len < sizeof(DirRecord) || len > superblock.block_size - off) return superblock.block_size;
+    return off + len;
+}
+
+// Turns a block into a single unused record spanning all of it
+static void dir_block_init(void *block) {
+    memset(block, 0, superblock.block_size);
+    dir_record(block, 0)->rec_len = (uint16_t)superblock.block_size;
+}
+
+// Offset of the live record called name in a directory block, or -1 if there
+// is none. If prev is not NULL it receives the offset of the record before
+// it, or -1 for the first record.
+static int dir_block_find(const void *block, const char *name, int *prev) {
+    size_t len = strlen(name);
+    int last = -1;
+    for (uint32_t off = 0; off < superblock.block_size; off = dir_next(block, off)) {
+        const DirRecord *rec = dir_record(block, off);
+        if (rec->inum != 0 && rec->name_len == len && memcmp(rec->name, name, len) == 0) {
+            if (prev) *prev = last;
+            return (int)off;
+        }
+        last = (int)off;
+    }
+    return -1;
+}
+
+// Stores an entry in the first record of a directory block with room for it,
+// splitting a live record's slack off into the new one.
+// Returns 0 on success, -1 if the block is too full.
+static int dir_block_insert(void *block, const DirectoryEntry *entry) {
+    size_t len = strlen(entry->name);
+    uint32_t need = DIR_REC_SIZE(len);
+    for (uint32_t off = 0; off < superblock.block_size; off = dir_next(block, off)) {
+        DirRecord *rec = dir_record(block, off);
+        uint32_t used = rec->inum != 0 ? DIR_REC_SIZE(rec->name_len) : 0;
+        if (rec->rec_len < used + need) continue;
+
+        if (used > 0) {
+            uint32_t rest = rec->rec_len - used;
+            rec->rec_len = (uint16_t)used;
+            rec = dir_record(block, off + used);
+            rec->rec_len = (uint16_t)rest;
+        }
+        rec->inum = entry->inum;
+        rec->name_len = (uint8_t)len;
+        rec->reserved = 0;
+        memcpy(rec->name, entry->name, len);
+        return 0;
+    }
+    return -1;
+}
+
+// Removes the record at off, given the offset of the record before it (or -1)
+static void dir_block_remove(void *block, uint32_t off, int prev) {
+    DirRecord *rec = dir_record(block, off);
+    if (prev < 0) {
+        rec->inum = 0; // The first record stays, unused
+        rec->name_len = 0;
+        return;
+    }
+    dir_record(block, (uint32_t)prev)->rec_len += rec->rec_len;
+}
 
-    if (block < INODE_START || block >= INODE_START + INODE_BLOCKS) {
-        fprintf(stderr, "Block %d is outside inode table!\n", block);
-        return -1;
+// Copies the live records of a directory block into out[] with their name
+// hashes; out may be NULL to only count them. Returns the number of records.
+static int dir_block_entries(const void *block, HashedEntry *out) {
+    int n = 0;
+    for (uint32_t off = 0; off < superblock.block_size; off = dir_next(block, off)) {
+        const DirRecord *rec = dir_record(block, off);
+        if (rec->inum == 0) continue;
+        if (out) {
+            out[n].entry.inum = rec->inum;
+            memcpy(out[n].entry.name, rec->name, rec->name_len);
+            out[n].entry.name[rec->name_len] = '\0';
+            out[n].hash = name_hash(out[n].entry.name);
+        }
+        n++;
     }
+    return n;
+}
 
-    Inode *inodes = malloc(BLOCK_SIZE);
-    if (!inodes) {
-        fprintf(stderr, "Memory allocation failed!\n");
-        return -1;
+// Packs entries into a directory block, the last record taking the rest of it.
+// Returns 0 on success, -1 if they do not fit.
+static int dir_block_fill(void *block, const HashedEntry *entries, int count) {
+    dir_block_init(block);
+    uint32_t off = 0;
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(entries[i].entry.name);
+        uint32_t size = DIR_REC_SIZE(len);
+        if (size > superblock.block_size - off) return -1;
+
+        DirRecord *rec = dir_record(block, off);
+        rec->inum = entries[i].entry.inum;
+        rec->rec_len = (uint16_t)(i == count - 1 ? superblock.block_size - off : size);
+        rec->name_len = (uint8_t)len;
+        memcpy(rec->name, entries[i].entry.name, len);
+        off += size;
     }
+    return 0;
+}
 
-    if (disk_read(block, inodes) != 0) {
-        fprintf(stderr, "Failed to read block %d\n", block);
-        free(inodes);
-        return -1;
+// Where to split hash-sorted entries between two directory blocks so that
+// each takes about half the bytes, without separating names that share a hash.
+// Returns the number of entries for the lower block, or -1 if no split fits.
+static int dir_split(const HashedEntry *entries, int n) {
+    uint32_t total = 0, lower = 0, best_gap = UINT32_MAX;
+    for (int i = 0; i < n; i++) total += DIR_REC_SIZE(strlen(entries[i].entry.name));
+
+    int best = -1;
+    for (int k = 1; k < n; k++) {
+        lower += DIR_REC_SIZE(strlen(entries[k - 1].entry.name));
+        if (entries[k].hash == entries[k - 1].hash) continue;
+        if (lower > superblock.block_size || total - lower > superblock.block_size) continue;
+        uint32_t gap = lower > total - lower ? 2 * lower - total : total - 2 * lower;
+        if (gap < best_gap) {
+            best = k;
+            best_gap = gap;
+        }
     }
+    return best;
+}
 
-    inodes[offset] = *inode;
+// Follows the index of a directory from its root down to the leaf for hash.
+// Returns 0 on success, -1 if an index block cannot be read.
+static int dir_walk(const Inode *dir, const DirIndex *root, uint32_t hash, DirPath *path) {
+    path->pos[0] = dir_index_find(root, hash);
+    path->leaf = root->entries[path->pos[0]].block;
+    path->node = 0;
+    if (!(dir->flags & INODE_FLAG_INDEX2)) return 0;
+
+    char block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    path->node = path->leaf;
+    const DirIndex *node = read_block_ref((int)path->node, block);
+    if (!node) return -1;
+    path->pos[1] = dir_index_find(node, hash);
+    path->leaf = node->entries[path->pos[1]].block;
+    return 0;
+}
 
-    if (disk_write(block, inodes) != 0) {
-        fprintf(stderr, "Failed to write block %d\n", block);
-        free(inodes);
-        return -1;
+// Finds the block that may hold name: the leaf it hashes to in an indexed
+// directory, or the single block of an unindexed one (0 if it has none yet).
+// Returns 0 on success, -1 on failure.
+static int dir_leaf(const Inode *dir, const char *name, uint32_t *leaf) {
+    if (!(dir->flags & INODE_FLAG_INDEXED)) {
+        *leaf = dir->direct_blocks[0];
+        return 0;
     }
 
-    free(inodes);
+    char block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    const DirIndex *root = read_block_ref((int)dir->direct_blocks[0], block);
+    DirPath path;
+    if (!root || dir_walk(dir, root, name_hash(name), &path) != 0) return -1;
+    *leaf = path.leaf;
     return 0;
 }
 
-int allocate_inode() {
-    Inode inode;
+// Returns every block holding records of a directory, in index order, as an
+// array the caller frees, and sets *count. Returns NULL on failure.
+static uint32_t *dir_all_leaves(const Inode *dir, int *count) {
+    char block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    char node_block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    uint32_t *leaves;
+    *count = 0;
 
-    for (int i = 0; i < INODE_COUNT; i++) {
-        if (read_inode(i, &inode) != 0) continue;
-        if (!inode.is_valid) {
-            inode.is_valid = 1;
-            inode.is_directory = 0;
-            inode.size = 0;
-            memset(inode.direct_blocks, 0, sizeof(inode.direct_blocks));
-            write_inode(i, &inode);
-            log_debug("[DEBUG] Allocated inode %d", i);
-            return i;
-        }
+    if (!(dir->flags & INODE_FLAG_INDEXED)) {
+        leaves = malloc(sizeof(*leaves));
+        if (!leaves) return NULL;
+        if (dir->direct_blocks[0] != 0) leaves[(*count)++] = dir->direct_blocks[0];
+        return leaves;
     }
-    return -1;  // No free inode
-}
- 
-void free_inode(int inum) {
-    Inode inode;
-    if (read_inode(inum, &inode) != 0) return;
-    inode.is_valid = 0;
-    write_inode(inum, &inode);
-    log_debug("[DEBUG] Freed inode %d", inum);
-}
 
-// Create a new filesystem on the disk
-
-int mkfs_fs(const char *disk_path) {
-    // 1. Create and zero-fill a new disk image
-    FILE *f = fopen(disk_path, "wb");
-    if (!f) return -1;
+    const DirIndex *root = read_block_ref((int)dir->direct_blocks[0], block);
+    if (!root) return NULL;
+    int levels = dir->flags & INODE_FLAG_INDEX2 ? 2 : 1;
+    leaves = malloc((size_t)root->count * (levels == 2 ? dir_index_capacity() : 1) * sizeof(*leaves));
+    if (!leaves) return NULL;
 
-    char zero[BLOCK_SIZE] = {0};
-    for (int i = 0; i < BLOCK_COUNT; i++) {
-        fwrite(zero, 1, BLOCK_SIZE, f);
+    for (uint32_t i = 0; i < root->count; i++) {
+        if (levels == 1) {
+            leaves[(*count)++] = root->entries[i].block;
+            continue;
+        }
+        const DirIndex *node = read_block_ref((int)root->entries[i].block, node_block);
+        if (!node) {
+            free(leaves);
+            return NULL;
+        }
+        for (uint32_t j = 0; j < node->count; j++) leaves[(*count)++] = node->entries[j].block;
     }
-    fclose(f);
+    return leaves;
+}
 
-    // 2. Open the disk using your disk I/O abstraction
-    if (disk_open(disk_path) != 0) return -1;
+int find_dir_entry(Inode *dir_inode, const char *name, DirectoryEntry *out_entry) {
+    char block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    uint32_t leaf;
+    if (dir_leaf(dir_inode, name, &leaf) != 0 || leaf == 0) return -1;
 
-    // 3. Create and write the superblock (block 0)
-    SuperBlock sb;
-    sb.magic = MAGIC_NUMBER;
-    sb.block_size = BLOCK_SIZE;
-    sb.fs_size_blocks = BLOCK_COUNT;
-    sb.inode_start = INODE_START;
-    sb.inode_count = INODE_COUNT;
-    sb.data_start = DATA_START;
+    const void *records = read_block_ref((int)leaf, block);
+    if (!records) return -1;
+    int off = dir_block_find(records, name, NULL);
+    if (off < 0) return -1; // not found
 
-    disk_write(0, &sb); // Block 0
+    if (out_entry) {
+        const DirRecord *rec = dir_record(records, (uint32_t)off);
+        out_entry->inum = rec->inum;
+        memcpy(out_entry->name, rec->name, rec->name_len);
+        out_entry->name[rec->name_len] = '\0';
+    }
+    return 0;
+}
 
-    // 4. Zero bitmap (block 1)
-    char bitmap_block[BLOCK_SIZE] = {0};
-    disk_write(1, bitmap_block); // Block 1
+// Returns 1 if a directory holds no entries, 0 if it does, -1 on failure
+static int dir_is_empty(const Inode *dir) {
+    char block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    int nleaves;
+    uint32_t *leaves = dir_all_leaves(dir, &nleaves);
+    if (!leaves) return -1;
+
+    int result = 1;
+    for (int i = 0; i < nleaves && result == 1; i++) {
+        const void *records = read_block_ref((int)leaves[i], block);
+        if (!records) result = -1;
+        else if (dir_block_entries(records, NULL) > 0) result = 0;
+    }
+    free(leaves);
+    return result;
+}
 
-    // 5. Zero inode table blocks (blocks 2–10)
-    for (int i = 0; i < INODE_BLOCKS; i++) {
-        disk_write(INODE_START + i, zero); // Blocks 2 to 10
+// Puts a record in an unindexed directory, giving an empty directory its
+// block. The duplicate check and the search for room share one read of the
+// block, and a name known to be absent skips the check.
+// Returns 0 on success, 1 if the name exists, 2 if the block is full, -1 on failure.
+static int dir_linear_insert(Inode *dir, const DirectoryEntry *entry, int known_absent) {
+    char block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+
+    if (dir->direct_blocks[0] == 0) {
+        int first = allocate_block();
+        if (first < 0) return -1;
+        dir_block_init(block);
+        dir_block_insert(block, entry);
+        if (disk_write(first, block) != 0) {
+            free_block(first);
+            return -1;
+        }
+        dir->direct_blocks[0] = (uint32_t)first;
+        return 0;
     }
 
-    // 6. Initialize inode 0 as root directory "/"
-    Inode root;
-    root.is_valid = 1;
-    root.is_directory = 1;
-    root.size = 0;
-    memset(root.direct_blocks, 0, sizeof(root.direct_blocks));
+    if (disk_read((int)dir->direct_blocks[0], block) != 0) return -1;
+    if (!known_absent && dir_block_find(block, entry->name, NULL) >= 0) return 1;
+    if (dir_block_insert(block, entry) != 0) return 2;
+    return disk_write((int)dir->direct_blocks[0], block);
+}
 
-    write_inode(0, &root);  // Save root inode to disk
+// Converts a full unindexed directory to an indexed one. A new index block
+// becomes logical block 0, with the old block as its only leaf; the insert
+// that follows splits that leaf. Returns 0 on success, -1 on failure.
+static int dir_make_index(Inode *dir) {
+    int index_block = allocate_block();
+    if (index_block < 0) return -1;
+
+    // Map the index block first, then the old block after it
+    uint32_t blocks[2] = { (uint32_t)index_block, dir->direct_blocks[0] };
+    dir->direct_blocks[0] = 0;
+    if (inode_map_blocks(dir, 0, blocks, 2) != 0) {
+        dir->direct_blocks[0] = blocks[1];
+        free_block(index_block);
+        return -1;
+    }
+    dir->flags |= INODE_FLAG_INDEXED;
 
-    disk_close();
-    return 0;
+    char block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    DirIndex *index = (DirIndex *)block;
+    memset(block, 0, superblock.block_size);
+    index->count = 1;
+    index->blocks = 2;
+    index->entries[0].hash = 0;
+    index->entries[0].block = blocks[1];
+    return disk_write(index_block, block);
 }
- 
-int split_path(const char *path, char parts[][MAX_FILENAME_LEN + 1], int *count) {
-    if (!path || path[0] != '/' || !parts || !count) return -1;  // Validate all input
 
-    *count = 0;
-    const char *p = path + 1; // skip initial '/'
+// Allocates a block for an indexed directory, writes data to it and maps it
+// after the directory's last block. Returns the block, or -1 on failure.
+static int dir_append_block(Inode *dir, DirIndex *root, const void *data) {
+    int block = allocate_block();
+    if (block < 0) return -1;
+    uint32_t mapped = (uint32_t)block;
+    if (disk_write(block, data) != 0 || inode_map_blocks(dir, root->blocks, &mapped, 1) != 0) {
+        free_block(block);
+        return -1;
+    }
+    root->blocks++;
+    return block;
+}
 
-    while (p && *p && *count < 64) {
-        const char *slash = strchr(p, '/');  // Find next '/'
-        size_t len = slash ? (size_t)(slash - p) : strlen(p);
-        if (len > MAX_FILENAME_LEN || len == 0) return -1;  // Check name length
+// Inserts (hash, block) into an index block right after entry pos
+static void dir_index_put(DirIndex *index, uint32_t pos, uint32_t hash, uint32_t block) {
+    memmove(&index->entries[pos + 2], &index->entries[pos + 1],
+            (index->count - pos - 1) * sizeof(DirIndexEntry));
+    index->entries[pos + 1].hash = hash;
+    index->entries[pos + 1].block = block;
+    index->count++;
+}
 
-        strncpy(parts[*count], p, len);  // Copy the part
-        parts[*count][len] = '\0';       // Null-terminate
-        (*count)++;
+// Moves the upper half of a full index block into upper, then inserts
+// (hash, block) after entry pos of the original list into whichever half
+// holds that position
+static void dir_index_split(DirIndex *index, DirIndex *upper, uint32_t pos, uint32_t hash, uint32_t block) {
+    uint32_t half = index->count / 2;
+    memset(upper, 0, superblock.block_size);
+    upper->count = index->count - half;
+    memcpy(upper->entries, index->entries + half, upper->count * sizeof(DirIndexEntry));
+    index->count = half;
+
+    if (pos < half) dir_index_put(index, pos, hash, block);
+    else dir_index_put(upper, pos - half, hash, block);
+}
 
-        p = slash ? slash + 1 : NULL;    // Move to next component
-    }
+// Adds (hash, block) to the index of a directory right after the entry path
+// took, splitting a full index block or moving a full root down a level.
+// The caller writes root back. Returns 0 on success, -1 on failure.
+static int dir_index_add(Inode *dir, DirIndex *root, const DirPath *path, uint32_t hash, uint32_t block) {
+    char node_block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    char upper_block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    DirIndex *node = (DirIndex *)node_block;
+    DirIndex *upper = (DirIndex *)upper_block;
+
+    if (!(dir->flags & INODE_FLAG_INDEX2)) {
+        if (root->count < dir_index_capacity()) {
+            dir_index_put(root, path->pos[0], hash, block);
+            return 0;
+        }
 
+        // Full root: its entries become two index blocks one level down
+        memcpy(node, root, superblock.block_size);
+        node->blocks = 0;
+        dir_index_split(node, upper, path->pos[0], hash, block);
+        int low = dir_append_block(dir, root, node);
+        int high = low < 0 ? -1 : dir_append_block(dir, root, upper);
+        if (high < 0) return -1;
+        root->count = 2;
+        root->entries[0].hash = 0;
+        root->entries[0].block = (uint32_t)low;
+        root->entries[1].hash = upper->entries[0].hash;
+        root->entries[1].block = (uint32_t)high;
+        dir->flags |= INODE_FLAG_INDEX2;
+        return 0;
+    }
+
+    if (disk_read((int)path->node, node_block) != 0) return -1;
+    if (node->count < dir_index_capacity()) {
+        dir_index_put(node, path->pos[1], hash, block);
+        return disk_write((int)path->node, node_block);
+    }
+
+    // Full index block: split it and add the upper half to the root
+    if (root->count == dir_index_capacity()) return -1;
+    dir_index_split(node, upper, path->pos[1], hash, block);
+    int high = dir_append_block(dir, root, upper);
+    if (high < 0 || disk_write((int)path->node, node_block) != 0) return -1;
+    dir_index_put(root, path->pos[0], upper->entries[0].hash, (uint32_t)high);
     return 0;
 }
 
-int find_dir_entry(Inode *dir_inode, const char *name, DirectoryEntry *out_entry) {
-    char block[BLOCK_SIZE];
-
-    for (int i = 0; i < MAX_DIRECT_POINTERS; i++) {
-        if (dir_inode->direct_blocks[i] == 0) continue;
+// Returns 1 if the index of a directory cannot take another entry below the
+// index block path went through, 0 if it can, -1 on failure
+static int dir_index_full(const Inode *dir, const DirIndex *root, const DirPath *path) {
+    if (!(dir->flags & INODE_FLAG_INDEX2) || root->count < dir_index_capacity()) return 0;
+    char block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    const DirIndex *node = read_block_ref((int)path->node, block);
+    if (!node) return -1;
+    return node->count == dir_index_capacity();
+}
 
-        disk_read(dir_inode->direct_blocks[i], block);
+// Puts a record in the leaf its name hashes to, checking for the name in the
+// same pass. A full leaf is split in two by hash into a new block, which is
+// then added to the index.
+// Returns 0 on success, 1 if the name exists, -1 on failure.
+static int dir_index_insert(Inode *dir, const DirectoryEntry *entry) {
+    char root_block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    char leaf[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    DirIndex *root = (DirIndex *)root_block;
+    uint32_t hash = name_hash(entry->name);
+    DirPath path;
+
+    if (disk_read((int)dir->direct_blocks[0], root_block) != 0) return -1;
+    if (dir_walk(dir, root, hash, &path) != 0) return -1;
+    if (disk_read((int)path.leaf, leaf) != 0) return -1;
+    if (dir_block_find(leaf, entry->name, NULL) >= 0) return 1;
+    if (dir_block_insert(leaf, entry) == 0) return disk_write((int)path.leaf, leaf);
+
+    // Full leaf: move the upper half of its hash range to a new leaf
+    if (dir_index_full(dir, root, &path) != 0) return -1;
+    HashedEntry *all = malloc((DIR_MAX_RECORDS + 1) * sizeof(*all));
+    if (!all) return -1;
+    int n = dir_block_entries(leaf, all);
+    all[n].hash = hash;
+    all[n++].entry = *entry;
+    qsort(all, (size_t)n, sizeof(*all), compare_hashed);
+
+    int result = -1;
+    char upper[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    int split = dir_split(all, n);
+    if (split < 0 || dir_block_fill(upper, all + split, n - split) != 0) goto done;
+    int new_leaf = dir_append_block(dir, root, upper);
+    if (new_leaf < 0) goto done;
+    // Only drop the moved records from the old leaf once the index names the new one
+    if (dir_index_add(dir, root, &path, all[split].hash, (uint32_t)new_leaf) != 0) {
+        disk_write((int)dir->direct_blocks[0], root_block); // Keep the block count right
+        goto done;
+    }
+    dir_block_fill(leaf, all, split);
+    if (disk_write((int)path.leaf, leaf) != 0) goto done;
+    result = disk_write((int)dir->direct_blocks[0], root_block);
+
+done:
+    free(all);
+    return result;
+}
 
-        int count = BLOCK_SIZE / sizeof(DirectoryEntry);
-        DirectoryEntry *entries = (DirectoryEntry *)block;
+// Adds name -> inum to a directory unless name is already there, and saves
+// the directory inode. A name the dentry cache knows about needs no
+// duplicate scan. Returns 0 on success, 1 if the name exists, -1 on failure.
+static int dir_add_entry(int dir_inum, Inode *dir, const char *name, uint32_t inum) {
+    uint32_t cached;
+    int known_absent = 0;
+    if (dentry_lookup((uint32_t)dir_inum, name, &cached)) {
+        if (cached != NO_INODE) return 1;
+        known_absent = 1;
+    }
+
+    DirectoryEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.inum = inum;
+    strncpy(entry.name, name, MAX_FILENAME_LEN);
+
+    int result;
+    if (dir->flags & INODE_FLAG_INDEXED) {
+        result = dir_index_insert(dir, &entry);
+    } else {
+        result = dir_linear_insert(dir, &entry, known_absent);
+        if (result == 2) result = dir_make_index(dir) == 0 ? dir_index_insert(dir, &entry) : -1;
+    }
+    if (result == 1) return 1;
+
+    if (result == 0) dir->size += DIR_REC_SIZE(strlen(entry.name));
+    if (write_inode(dir_inum, dir) != 0) return -1; // Also records a conversion
+    return result;
+}
 
-        for (int j = 0; j < count; j++) {
-            if (entries[j].inum != 0 && strcmp(entries[j].name, name) == 0) {
-                if (out_entry) *out_entry = entries[j];
-                return 0;
-            }
-        }
-    }
-    return -1; // not found
+// Removes the entry name -> inum from a directory and saves the directory inode.
+// Returns 0 on success, -1 if there is no such entry or on failure.
+static int dir_remove_entry(int dir_inum, Inode *dir, const char *name, uint32_t inum) {
+    char block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    uint32_t leaf;
+    if (dir_leaf(dir, name, &leaf) != 0 || leaf == 0) return -1;
+    if (disk_read((int)leaf, block) != 0) return -1;
+
+    int prev;
+    int off = dir_block_find(block, name, &prev);
+    if (off < 0 || dir_record(block, (uint32_t)off)->inum != inum) return -1;
+    dir->size -= DIR_REC_SIZE(strlen(name));
+    dir_block_remove(block, (uint32_t)off, prev);
+    if (disk_write((int)leaf, block) != 0) return -1;
+    return write_inode(dir_inum, dir);
 }
 
 int path_to_inode(const char *path, int *out_inum, int want_parent) {
@@ -267,17 +1922,23 @@ int path_to_inode(const char *path, int *out_inum, int want_parent) {
     Inode inode;
 
     for (int i = 0; i < count - want_parent; i++) {
-        
-        if (read_inode(current_inum, &inode) != 0) return -1;
-        if (!inode.is_valid || !inode.is_directory) return -1;
+        // Components seen before, found or not, come from the dentry cache
+        uint32_t next;
+        if (!dentry_lookup((uint32_t)current_inum, parts[i], &next)) {
+            if (read_inode(current_inum, &inode) != 0) return -1;
+            if (!inode.is_valid || !inode.is_directory) return -1;
+
+            DirectoryEntry entry;
+            next = find_dir_entry(&inode, parts[i], &entry) == 0 ? entry.inum : NO_INODE;
+            dentry_insert((uint32_t)current_inum, parts[i], next);
+        }
 
-        DirectoryEntry entry;
-        if (find_dir_entry(&inode, parts[i], &entry) != 0) {
+        if (next == NO_INODE) {
             printf("Path component '%s' not found in inode %d\n", parts[i], current_inum);
             return -1;  // Not found
         }
 
-        current_inum = entry.inum;
+        current_inum = (int)next;
     }
 
     if (out_inum) *out_inum = current_inum;
@@ -315,93 +1976,33 @@ int mkdir_fs(const char *path) {
         return -1;
     }
 
-    // Step 4: Check if the directory already exists
-    DirectoryEntry dummy;
-    if (find_dir_entry(&parent, dirname, &dummy) == 0) {
-        fprintf(stderr, "mkdir_fs: Directory '%s' already exists\n", dirname);
-        return -1;
-    }
-
-    // Step 5: Allocate new inode for the directory
+    // Step 4: Allocate new inode for the directory
     int new_inum = allocate_inode();
     if (new_inum < 0) {
         fprintf(stderr, "mkdir_fs: Failed to allocate inode for new directory\n");
         return -1;
     }
 
-    // Step 6: Initialize the new inode as a directory
+    // Step 5: Initialize the new inode as a directory
     Inode new_dir;
+    memset(&new_dir, 0, sizeof(new_dir)); // No blocks yet, direct or indirect
     new_dir.is_valid = 1;
     new_dir.is_directory = 1;
-    new_dir.size = 0;
-    memset(new_dir.direct_blocks, 0, sizeof(new_dir.direct_blocks));
 
     if (write_inode(new_inum, &new_dir) != 0) {
         fprintf(stderr, "mkdir_fs: Failed to write new directory inode %d\n", new_inum);
         return -1;
     }
 
-    // Step 7: Add directory entry to parent
-    char block[BLOCK_SIZE];
-    int entry_added = 0;
-
-    for (int i = 0; i < MAX_DIRECT_POINTERS && !entry_added; i++) {
-        if (parent.direct_blocks[i] == 0) {
-            // Allocate a new block for directory entries
-            int new_block = allocate_block();
-            if (new_block < 0) {
-                fprintf(stderr, "mkdir_fs: Failed to allocate block for directory entries\n");
-                return -1;
-            }
-
-            parent.direct_blocks[i] = new_block;
-            memset(block, 0, BLOCK_SIZE);
-
-            // Fix: SAVE THE UPDATED PARENT INODE IMMEDIATELY
-            if (write_inode(parent_inum, &parent) != 0) {
-                fprintf(stderr, "mkdir_fs: Failed to save parent inode after block allocation\n");
-                return -1;
-            }
-
-        } else {
-            // Load existing directory entry block
-            if (disk_read(parent.direct_blocks[i], block) != 0) {
-                fprintf(stderr, "mkdir_fs: Failed to read existing directory block %d\n", parent.direct_blocks[i]);
-                return -1;
-            }
-        }
-
-        DirectoryEntry *entries = (DirectoryEntry *)block;
-        int entries_per_block = BLOCK_SIZE / sizeof(DirectoryEntry);
-
-        for (int j = 0; j < entries_per_block; j++) {
-            if (entries[j].inum == 0) {
-                entries[j].inum = new_inum;
-                strncpy(entries[j].name, dirname, MAX_FILENAME_LEN);
-                entries[j].name[MAX_FILENAME_LEN] = '\0';
-
-                // Write back updated directory block
-                if (disk_write(parent.direct_blocks[i], block) != 0) {
-                    fprintf(stderr, "mkdir_fs: Failed to write directory block back to disk\n");
-                    return -1;
-                }
-
-                parent.size += sizeof(DirectoryEntry);
-                if (write_inode(parent_inum, &parent) != 0) {
-                    fprintf(stderr, "mkdir_fs: Failed to update parent inode with new size\n");
-                    return -1;
-                }
-
-                entry_added = 1;
-                break;
-            }
-        }
-    }
-
-    if (!entry_added) {
-        fprintf(stderr, "mkdir_fs: No space in parent directory to add new entry '%s'\n", dirname);
+    // Step 6: Add directory entry to parent; this also rejects an existing name
+    int added = dir_add_entry(parent_inum, &parent, dirname, (uint32_t)new_inum);
+    if (added != 0) {
+        if (added == 1) fprintf(stderr, "mkdir_fs: Directory '%s' already exists\n", dirname);
+        else fprintf(stderr, "mkdir_fs: No space in parent directory to add new entry '%s'\n", dirname);
+        free_inode(new_inum);
         return -1;
     }
+    dentry_insert((uint32_t)parent_inum, dirname, (uint32_t)new_inum);
 
     return 0;
 }
@@ -437,13 +2038,6 @@ int create_fs(const char *path) {
         return -1;
     }
 
-    // Check if the file already exists in the parent's directory entries.
-    DirectoryEntry dummy;
-    if (find_dir_entry(&parent, filename, &dummy) == 0) {
-        fprintf(stderr, "create_fs: File %s already exists in parent directory\n", filename);
-        return -1;
-    }
-
     // Allocate a new inode for the file.
     int new_inum = allocate_inode();
     if (new_inum < 0) {
@@ -453,68 +2047,25 @@ int create_fs(const char *path) {
 
     // Prepare the new file inode: mark as valid, not a directory, size zero.
     Inode new_file;
+    memset(&new_file, 0, sizeof(new_file)); // No blocks yet, direct or indirect
     new_file.is_valid = 1;
     new_file.is_directory = 0;  // file, not a directory
-    new_file.size = 0;
-    memset(new_file.direct_blocks, 0, sizeof(new_file.direct_blocks));
 
     if (write_inode(new_inum, &new_file) != 0) {
         fprintf(stderr, "create_fs: Failed to write new inode %d\n", new_inum);
         return -1;
     }
 
-    // Now, add an entry for this new file into the parent directory.
-    // For simplicity, we search parent's direct_blocks for an available slot.
-    int entry_added = 0;
-    char block_buf[BLOCK_SIZE];
-    for (int i = 0; i < MAX_DIRECT_POINTERS && !entry_added; i++) {
-        // If the parent's direct block is not allocated yet, allocate one.
-        if (parent.direct_blocks[i] == 0) {
-            int blk = allocate_block();
-            if (blk < 0) {
-                fprintf(stderr, "create_fs: Failed to allocate a data block for directory entries\n");
-                return -1;
-            }
-            parent.direct_blocks[i] = blk;
-            memset(block_buf, 0, BLOCK_SIZE);
-        } else {
-            // Read the existing block into block_buf.
-            disk_read(parent.direct_blocks[i], block_buf);
-        }
-
-        // How many directory entries fit in one block?
-        int entry_count = BLOCK_SIZE / sizeof(DirectoryEntry);
-        DirectoryEntry *entries = (DirectoryEntry *)block_buf;
-
-        // Find an empty slot (inum == 0 means free)
-        for (int j = 0; j < entry_count; j++) {
-            if (entries[j].inum == 0) {
-                entries[j].inum = new_inum;
-                // Copy the filename (ensure null-termination)
-                strncpy(entries[j].name, filename, MAX_FILENAME_LEN);
-                entries[j].name[MAX_FILENAME_LEN] = '\0';
-                // Write the block back to disk
-                if (disk_write(parent.direct_blocks[i], block_buf) != 0) {
-                    fprintf(stderr, "create_fs: Failed to update directory entry block\n");
-                    return -1;
-                }
-                // Update parent's size (optional: increment by size of entry)
-                parent.size += sizeof(DirectoryEntry);
-                // Write the updated parent inode back
-                if (write_inode(parent_inum, &parent) != 0) {
-                    fprintf(stderr, "create_fs: Failed to update parent inode\n");
-                    return -1;
-                }
-                entry_added = 1;
-                break;
-            }
-        }
-    }
-
-    if (!entry_added) {
-        fprintf(stderr, "create_fs: No free directory entry slot for file %s\n", filename);
+    // Now, add an entry for this new file into the parent directory. The same
+    // pass over the parent rejects a name that already exists.
+    int added = dir_add_entry(parent_inum, &parent, filename, (uint32_t)new_inum);
+    if (added != 0) {
+        if (added == 1) fprintf(stderr, "create_fs: File %s already exists in parent directory\n", filename);
+        else fprintf(stderr, "create_fs: No free directory entry slot for file %s\n", filename);
+        free_inode(new_inum);
         return -1;
     }
+    dentry_insert((uint32_t)parent_inum, filename, (uint32_t)new_inum);
 
     return 0;
 }
@@ -523,9 +2074,9 @@ int create_fs(const char *path) {
 // 'data' is a pointer to the bytes, and 'size' is the number of bytes to write.
 // Returns number of bytes written on success, -1 on failure.
 int write_fs(const char *path, const void *data, size_t size) {
-    // Limit to maximum file size (4 blocks)
-    if (size > MAX_DIRECT_POINTERS * BLOCK_SIZE) {
-        fprintf(stderr, "write_fs: File size too large (max is %d bytes)\n", MAX_DIRECT_POINTERS * BLOCK_SIZE);
+    if (size > max_file_size()) {
+        fprintf(stderr, "write_fs: File size too large (max is %llu bytes)\n",
+                (unsigned long long)max_file_size());
         return -1;
     }
 
@@ -537,47 +2088,64 @@ int write_fs(const char *path, const void *data, size_t size) {
     }
 
     Inode file;
-    if (read_inode(file_inum, &file) != 0) {
-        fprintf(stderr, "write_fs: Failed to read inode for file %s\n", path);
+    if (read_inode(file_inum, &file) != 0 || !file.is_valid || file.is_directory) {
+        fprintf(stderr, "write_fs: %s is not a writable file\n", path);
         return -1;
     }
 
-    // For simplicity, free any pre-allocated data blocks before writing new data.
-    // (In a more complete FS, you would handle writing over existing data.)
-    for (int i = 0; i < MAX_DIRECT_POINTERS; i++) {
-        if (file.direct_blocks[i] != 0) {
-            free_block(file.direct_blocks[i]);
-            file.direct_blocks[i] = 0;
-        }
-    }
-
-    size_t bytes_left = size;
-    const char *data_ptr = data;
-    int block_index = 0;
-
-    // Write data into as many blocks as needed.
-    while (bytes_left > 0 && block_index < MAX_DIRECT_POINTERS) {
-        int blk = allocate_block();
-        if (blk < 0) {
-            fprintf(stderr, "write_fs: No free data block available\n");
+    // Tiny files live in the inode itself: no block allocation, no data write
+    if (size > 0 && size <= INODE_INLINE_SIZE) {
+        inode_truncate(&file);
+        memcpy(inode_inline_data(&file), data, size);
+        file.flags |= INODE_FLAG_INLINE;
+        file.size = size;
+        if (write_inode(file_inum, &file) != 0) {
+            fprintf(stderr, "write_fs: Failed to update inode for file %s\n", path);
             return -1;
         }
-
-        file.direct_blocks[block_index] = blk;
-        char block_data[BLOCK_SIZE];
-        memset(block_data, 0, BLOCK_SIZE);
-
-        // Determine how many bytes to write in this block.
-        size_t to_write = (bytes_left > BLOCK_SIZE) ? BLOCK_SIZE : bytes_left;
-        memcpy(block_data, data_ptr, to_write);
-        if (disk_write(blk, block_data) != 0) {
-            fprintf(stderr, "write_fs: Error writing block %d\n", blk);
+        return (int)size;
+    }
+
+    // Overwrite in place: keep the blocks the file already has, allocating only
+    // for growth and freeing only the tail on shrink
+    uint8_t moved[INODE_INLINE_SIZE];
+    size_t moved_len = 0;
+    if (file.flags & INODE_FLAG_INLINE) {
+        moved_len = file.size;
+        memcpy(moved, inode_inline_data(&file), moved_len);
+        inode_truncate(&file);
+        file.size = 0;
+    }
+    uint32_t old_size = file.size;
+    uint32_t old_blocks = size_to_blocks(file.size);
+    uint32_t new_blocks = size_to_blocks(size);
+    if (new_blocks < old_blocks) {
+        if (inode_shrink(&file, new_blocks) != 0) {
+            fprintf(stderr, "write_fs: Failed to free data blocks of %s\n", path);
             return -1;
         }
+        file.size = size;
+    } else if (inode_grow(&file, old_blocks, new_blocks) != 0) {
+        fprintf(stderr, "write_fs: No free data block available\n");
+        return -1;
+    }
 
-        data_ptr += to_write;
-        bytes_left -= to_write;
-        block_index++;
+    // Everything past the new end is replaced, so the final partial block is
+    // padded with zeros rather than read back
+    if (inode_write_range(&file, data, 0, size, 0) != 0) {
+        fprintf(stderr, "write_fs: Error writing data blocks for %s\n", path);
+        // Give back the blocks this write added so the size matches the mapping
+        if (new_blocks > old_blocks) {
+            inode_shrink(&file, old_blocks);
+            file.size = old_size;
+        }
+        if (moved_len > 0) {
+            memcpy(inode_inline_data(&file), moved, moved_len);
+            file.flags |= INODE_FLAG_INLINE;
+            file.size = moved_len;
+        }
+        write_inode(file_inum, &file);
+        return -1;
     }
 
     file.size = size;
@@ -610,27 +2178,175 @@ int read_fs(const char *path, void *buffer, size_t size) {
     if (size > file.size)
         size = file.size;
 
-    size_t bytes_left = size;
-    char *buf_ptr = buffer;
-    int total_read = 0;
-    int block_index = 0;
+    if (inode_read_range(&file, buffer, 0, size) != 0) {
+        fprintf(stderr, "read_fs: Error reading data blocks for %s\n", path);
+        return -1;
+    }
+
+    return (int)size;
+}
 
-    while (bytes_left > 0 && block_index < MAX_DIRECT_POINTERS) {
-        if (file.direct_blocks[block_index] == 0) break;  // No more blocks allocated
-        char block_data[BLOCK_SIZE];
-        if (disk_read(file.direct_blocks[block_index], block_data) != 0) {
-            fprintf(stderr, "read_fs: Error reading block %d\n", file.direct_blocks[block_index]);
-            return -1;
-        }
-        size_t to_read = (bytes_left > BLOCK_SIZE) ? BLOCK_SIZE : bytes_left;
-        memcpy(buf_ptr, block_data, to_read);
-        buf_ptr += to_read;
-        bytes_left -= to_read;
-        total_read += to_read;
-        block_index++;
+// pread_fs(): reads up to 'size' bytes starting at byte 'offset' of the file.
+// Only the blocks covering the range are read.
+// Returns number of bytes read (0 at or past end of file), or -1 on failure.
+int pread_fs(const char *path, void *buffer, size_t size, size_t offset) {
+    int file_inum;
+    if (path_to_inode(path, &file_inum, 0) != 0) {
+        fprintf(stderr, "pread_fs: File %s not found\n", path);
+        return -1;
+    }
+
+    Inode file;
+    if (read_inode(file_inum, &file) != 0 || !file.is_valid || file.is_directory) {
+        fprintf(stderr, "pread_fs: %s is not a readable file\n", path);
+        return -1;
+    }
+
+    // Only read up to the file's size
+    if (offset >= file.size) return 0;
+    if (size > file.size - offset) size = file.size - offset;
+    if (size > INT32_MAX) size = INT32_MAX;
+
+    if (inode_read_range(&file, buffer, offset, size) != 0) {
+        fprintf(stderr, "pread_fs: Error reading data blocks for %s\n", path);
+        return -1;
+    }
+    return (int)size;
+}
+
+// pwrite_fs(): writes 'size' bytes at byte 'offset' of the file, growing it if
+// the range ends past the end of file. Only the blocks covering the range are
+// written, and partial blocks at the edges are read-modify-written.
+// Returns number of bytes written, or -1 on failure.
+int pwrite_fs(const char *path, const void *data, size_t size, size_t offset) {
+    int file_inum;
+    if (path_to_inode(path, &file_inum, 0) != 0) {
+        fprintf(stderr, "pwrite_fs: File %s not found\n", path);
+        return -1;
+    }
+
+    Inode file;
+    if (read_inode(file_inum, &file) != 0 || !file.is_valid || file.is_directory) {
+        fprintf(stderr, "pwrite_fs: %s is not a writable file\n", path);
+        return -1;
+    }
+
+    return inode_pwrite(file_inum, &file, data, size, offset);
+}
+
+int append_fs(const char *path, const void *data, size_t size) {
+    int file_inum;
+    if (path_to_inode(path, &file_inum, 0) != 0) {
+        fprintf(stderr, "append_fs: File %s not found\n", path);
+        return -1;
+    }
+
+    Inode file;
+    if (read_inode(file_inum, &file) != 0 || !file.is_valid || file.is_directory) {
+        fprintf(stderr, "append_fs: %s is not a writable file\n", path);
+        return -1;
+    }
+
+    // Only the last partial block and any new blocks are touched
+    return inode_pwrite(file_inum, &file, data, size, file.size);
+}
+
+int open_fs(const char *path) {
+    int file_inum;
+    if (path_to_inode(path, &file_inum, 0) != 0) {
+        fprintf(stderr, "open_fs: File %s not found\n", path);
+        return -1;
+    }
+
+    Inode file;
+    if (read_inode(file_inum, &file) != 0 || !file.is_valid || file.is_directory) {
+        fprintf(stderr, "open_fs: %s is not a regular file\n", path);
+        return -1;
+    }
+
+    for (int fd = 0; fd < MAX_OPEN_FILES; fd++) {
+        if (open_files[fd].in_use) continue;
+        open_files[fd].in_use = 1;
+        open_files[fd].inum = file_inum;
+        open_files[fd].inode = file;
+        open_files[fd].pos = 0;
+        return fd;
+    }
+    fprintf(stderr, "open_fs: Too many open files (max is %d)\n", MAX_OPEN_FILES);
+    return -1;
+}
+
+// Returns the open file behind a handle, or NULL (with a message) if the
+// handle is not open
+static OpenFile *open_file(int fd, const char *caller) {
+    if (fd < 0 || fd >= MAX_OPEN_FILES || !open_files[fd].in_use) {
+        fprintf(stderr, "%s: Bad file handle %d\n", caller, fd);
+        return NULL;
+    }
+    return &open_files[fd];
+}
+
+int close_fs(int fd) {
+    OpenFile *file = open_file(fd, "close_fs");
+    if (!file) return -1;
+    file->in_use = 0;
+    return 0;
+}
+
+// fread_fs(): reads up to 'size' bytes at the handle's offset and advances it.
+// Uses the cached inode, so no path lookup or inode table access is needed.
+// Returns number of bytes read (0 at end of file), or -1 on failure.
+int fread_fs(int fd, void *buffer, size_t size) {
+    OpenFile *file = open_file(fd, "fread_fs");
+    if (!file) return -1;
+
+    if (file->pos >= file->inode.size) return 0;
+    if (size > file->inode.size - file->pos) size = file->inode.size - file->pos;
+    if (size > INT32_MAX) size = INT32_MAX;
+
+    if (inode_read_range(&file->inode, buffer, file->pos, size) != 0) {
+        fprintf(stderr, "fread_fs: Error reading data blocks\n");
+        return -1;
+    }
+    file->pos += size;
+    return (int)size;
+}
+
+// fwrite_fs(): writes 'size' bytes at the handle's offset and advances it,
+// growing the file as pwrite_fs does.
+// Returns number of bytes written, or -1 on failure.
+int fwrite_fs(int fd, const void *data, size_t size) {
+    OpenFile *file = open_file(fd, "fwrite_fs");
+    if (!file) return -1;
+
+    int result = inode_pwrite(file->inum, &file->inode, data, size, file->pos);
+    if (result < 0) {
+        read_inode(file->inum, &file->inode); // Drop any half-made changes
+        return -1;
     }
+    file->pos += (size_t)result;
+    return result;
+}
 
-    return total_read;
+long seek_fs(int fd, long offset, int whence) {
+    OpenFile *file = open_file(fd, "seek_fs");
+    if (!file) return -1;
+
+    long base;
+    switch (whence) {
+    case SEEK_SET: base = 0; break;
+    case SEEK_CUR: base = (long)file->pos; break;
+    case SEEK_END: base = (long)file->inode.size; break;
+    default:
+        fprintf(stderr, "seek_fs: Invalid whence %d\n", whence);
+        return -1;
+    }
+    if (offset < -base || offset > (long)max_file_size() - base) {
+        fprintf(stderr, "seek_fs: Offset out of range\n");
+        return -1;
+    }
+    file->pos = (size_t)(base + offset);
+    return (long)file->pos;
 }
 
 int delete_fs(const char *path) {
@@ -676,55 +2392,25 @@ int delete_fs(const char *path) {
     }
 
     // Step 7: If target is a directory, ensure it's empty
-    if (target.is_directory) {
-        char block[BLOCK_SIZE];
-        for (int i = 0; i < MAX_DIRECT_POINTERS; i++) {
-            if (target.direct_blocks[i] == 0) continue;
-            disk_read(target.direct_blocks[i], block);
-            DirectoryEntry *entries = (DirectoryEntry *)block;
-            int num_entries = BLOCK_SIZE / sizeof(DirectoryEntry);
-            for (int j = 0; j < num_entries; j++) {
-                if (entries[j].inum != 0) {
-                    fprintf(stderr, "delete_fs: Directory '%s' is not empty\n", target_name);
-                    return -1;
-                }
-            }
-        }
+    if (target.is_directory && dir_is_empty(&target) != 1) {
+        fprintf(stderr, "delete_fs: Directory '%s' is not empty\n", target_name);
+        return -1;
     }
 
     // Step 8: Free all data blocks of the target
-    for (int i = 0; i < MAX_DIRECT_POINTERS; i++) {
-        if (target.direct_blocks[i] != 0) {
-            free_block(target.direct_blocks[i]);
-            target.direct_blocks[i] = 0;
-        }
-    }
+    inode_truncate(&target);
 
-    // Step 9: Invalidate the inode
-    target.is_valid = 0;
-    write_inode(target_inum, &target);
+    // Step 9: Invalidate the inode and return it to the free list
+    free_inode(target_inum);
 
     // Step 10: Remove the directory entry from the parent
-    char block[BLOCK_SIZE];
-    for (int i = 0; i < MAX_DIRECT_POINTERS; i++) {
-        if (parent.direct_blocks[i] == 0) continue;
-        disk_read(parent.direct_blocks[i], block);
-        DirectoryEntry *entries = (DirectoryEntry *)block;
-        int entry_count = BLOCK_SIZE / sizeof(DirectoryEntry);
-        for (int j = 0; j < entry_count; j++) {
-            if (entries[j].inum == target_inum && strcmp(entries[j].name, target_name) == 0) {
-                entries[j].inum = 0;
-                entries[j].name[0] = '\0';  // Clear name
-                disk_write(parent.direct_blocks[i], block);
-                parent.size -= sizeof(DirectoryEntry);
-                write_inode(parent_inum, &parent);
-                return 0;
-            }
-        }
+    if (dir_remove_entry(parent_inum, &parent, target_name, target_inum) != 0) {
+        fprintf(stderr, "delete_fs: Could not remove entry from parent directory\n");
+        return -1;
     }
-
-    fprintf(stderr, "delete_fs: Could not remove entry from parent directory\n");
-    return -1;
+    dentry_insert((uint32_t)parent_inum, target_name, NO_INODE);
+    if (target.is_directory) dentry_forget_dir(target_inum);
+    return 0;
 }
 
 int rmdir_fs(const char *path) {
@@ -774,53 +2460,27 @@ int rmdir_fs(const char *path) {
     }
 
     // Step 5: Ensure directory is empty
-    char block[BLOCK_SIZE];
-    for (int i = 0; i < MAX_DIRECT_POINTERS; i++) {
-        if (target.direct_blocks[i] == 0) continue;
-        if (disk_read(target.direct_blocks[i], block) != 0) return -1;
-        DirectoryEntry *entries = (DirectoryEntry *)block;
-        int entry_count = BLOCK_SIZE / sizeof(DirectoryEntry);
-        for (int j = 0; j < entry_count; j++) {
-            if (entries[j].inum != 0) {
-                fprintf(stderr, "rmdir_fs: Directory '%s' is not empty\n", target_name);
-                return -1;
-            }
-        }
+    int empty = dir_is_empty(&target);
+    if (empty < 0) return -1;
+    if (!empty) {
+        fprintf(stderr, "rmdir_fs: Directory '%s' is not empty\n", target_name);
+        return -1;
     }
 
     // Step 6: Free all blocks
-    for (int i = 0; i < MAX_DIRECT_POINTERS; i++) {
-        if (target.direct_blocks[i] != 0) {
-            free_block(target.direct_blocks[i]);
-            target.direct_blocks[i] = 0;
-        }
-    }
+    inode_truncate(&target);
 
-    // Step 7: Mark inode as invalid
-    target.is_valid = 0;
-    write_inode(target_inum, &target);
+    // Step 7: Invalidate the inode and return it to the free list
+    free_inode(target_inum);
 
     // Step 8: Remove directory entry from parent
-    for (int i = 0; i < MAX_DIRECT_POINTERS; i++) {
-        if (parent.direct_blocks[i] == 0) continue;
-        if (disk_read(parent.direct_blocks[i], block) != 0) return -1;
-        DirectoryEntry *entries = (DirectoryEntry *)block;
-        int entry_count = BLOCK_SIZE / sizeof(DirectoryEntry);
-        for (int j = 0; j < entry_count; j++) {
-            if (entries[j].inum == target_inum &&
-                strcmp(entries[j].name, target_name) == 0) {
-                entries[j].inum = 0;
-                entries[j].name[0] = '\0';
-                disk_write(parent.direct_blocks[i], block);
-                parent.size -= sizeof(DirectoryEntry);
-                write_inode(parent_inum, &parent);
-                return 0;
-            }
-        }
+    if (dir_remove_entry(parent_inum, &parent, target_name, target_inum) != 0) {
+        fprintf(stderr, "rmdir_fs: Failed to remove entry from parent\n");
+        return -1;
     }
-
-    fprintf(stderr, "rmdir_fs: Failed to remove entry from parent\n");
-    return -1;
+    dentry_insert((uint32_t)parent_inum, target_name, NO_INODE);
+    dentry_forget_dir(target_inum);
+    return 0;
 }
 
 int ls_fs(const char *path, DirectoryEntry *entries, int max_entries) {
@@ -841,22 +2501,30 @@ int ls_fs(const char *path, DirectoryEntry *entries, int max_entries) {
 
     // Step 2: Scan directory blocks for entries
     int total_found = 0;
-    char block[BLOCK_SIZE];
+    char block[MAX_BLOCK_SIZE] DISK_ALIGNED;
 
-    for (int i = 0; i < MAX_DIRECT_POINTERS && total_found < max_entries; i++) {
-        if (dir.direct_blocks[i] == 0) continue;
-        if (disk_read(dir.direct_blocks[i], block) != 0) return -1;
+    int nleaves;
+    uint32_t *leaves = dir_all_leaves(&dir, &nleaves);
+    if (!leaves) return -1;
 
-        DirectoryEntry *block_entries = (DirectoryEntry *)block;
-        int count = BLOCK_SIZE / sizeof(DirectoryEntry);
+    for (int i = 0; i < nleaves && total_found < max_entries; i++) {
+        const void *records = read_block_ref((int)leaves[i], block);
+        if (!records) {
+            free(leaves);
+            return -1;
+        }
 
-        for (int j = 0; j < count && total_found < max_entries; j++) {
-            if (block_entries[j].inum != 0) {
-                entries[total_found++] = block_entries[j];
-            }
+        for (uint32_t off = 0; off < superblock.block_size && total_found < max_entries;
+             off = dir_next(records, off)) {
+            const DirRecord *rec = dir_record(records, off);
+            if (rec->inum == 0) continue;
+            entries[total_found].inum = rec->inum;
+            memcpy(entries[total_found].name, rec->name, rec->name_len);
+            entries[total_found++].name[rec->name_len] = '\0';
         }
     }
 
+    free(leaves);
     return total_found;
 }
 
@@ -864,25 +2532,75 @@ int ls_fs(const char *path, DirectoryEntry *entries, int max_entries) {
 static int fs_initialized = 0;
 
 int init_fs(const char* disk_path) {
+    return init_fs_ex(disk_path, DISK_BACKEND_STDIO);
+}
+
+int init_fs_ex(const char* disk_path, int disk_backend) {
     if (fs_initialized) {
         return 0; // Already initialized
     }
     
-    if (disk_open(disk_path) != 0) {
+    if (disk_open_ex(disk_path, disk_backend) != 0) {
+        return -1;
+    }
+    memset(map_cache, 0, sizeof(map_cache)); // Nothing cached may come from another image
+
+    // Read the superblock with the default geometry, then switch to the
+    // geometry it records. The superblock fits in the first block of any size.
+    char sb_block[MAX_BLOCK_SIZE] DISK_ALIGNED;
+    if (disk_read(0, sb_block) != 0) {
+        disk_close();
+        return -1;
+    }
+    memcpy(&superblock, sb_block, sizeof(superblock));
+
+    if (superblock.magic != MAGIC_NUMBER ||
+        disk_set_geometry(superblock.block_size, superblock.fs_size_blocks) != 0) {
+        fprintf(stderr, "init_fs: %s does not contain a valid filesystem\n", disk_path);
+        disk_close();
+        return -1;
+    }
+    if (superblock.version < FS_MIN_VERSION || superblock.version > FS_VERSION) {
+        fprintf(stderr, "init_fs: %s uses on-disk format version %u, expected %d to %d; run mkfs to reformat\n",
+                disk_path, superblock.version, FS_MIN_VERSION, FS_VERSION);
+        disk_close();
         return -1;
     }
     
     // Load all necessary filesystem metadata
     load_bitmap();
+    if (!bitmap || load_inode_table() != 0) {
+        release_bitmap();
+        disk_close();
+        return -1;
+    }
+    superblock_dirty = 0;
     
     fs_initialized = 1;
     return 0;
 }
 
+// Write all pending metadata and force the disk image onto stable storage
+int sync_fs() {
+    if (!fs_initialized) return -1;
+    save_bitmap();
+    if (bitmap_has_dirty()) return -1; // A bitmap write failed
+    if (save_inode_table() != 0 || save_superblock() != 0) return -1;
+    return disk_sync();
+}
+
 void cleanup_fs() {
     if (fs_initialized) {
-        save_bitmap(); // Ensure bitmap is saved
+        save_bitmap();      // Write the bitmap once, if anything changed
+        save_inode_table(); // Write back the changed inode table blocks in one batch
+        save_superblock();
+        disk_flush();       // Write back every dirty cached block
         disk_close();
+        release_bitmap();
+        release_inode_table();
+        memset(open_files, 0, sizeof(open_files)); // Handles do not outlive the mount
+        memset(dentry_cache, 0, sizeof(dentry_cache));
+        memset(map_cache, 0, sizeof(map_cache)); // Keyed by block number, so only valid for this image
         fs_initialized = 0;
     }
 }
\ No newline at end of file
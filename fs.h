@@ -13,56 +13,93 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
+#include "disk.h"
 
 /**
- * @brief Size of a single block in bytes.
+ * @brief Starting block index for inodes on an image with a single bitmap block.
+ *
+ * Larger images have more bitmap blocks; the superblock records where their
+ * inode table actually starts.
  */
-#define BLOCK_SIZE 1024
+#define INODE_START 2
 
 /**
- * @brief Total number of blocks in the file system.
+ * @brief Number of disk blocks per inode; mkfs creates fs_size_blocks / BLOCKS_PER_INODE inodes.
  */
-#define BLOCK_COUNT 1024
+#define BLOCKS_PER_INODE 8
 
 /**
- * @brief Number of blocks reserved for storing inodes.
+ * @brief Magic number used to identify the file system.
  */
-#define INODE_BLOCKS 9
+#define MAGIC_NUMBER 0xf00dbeef
 
 /**
- * @brief Starting block index for inodes.
+ * @brief On-disk format version written by mkfs.
+ *
+ * Version 2 added the indirect block pointers to Inode; version 3 added
+ * extent-mapped inodes, version 4 inline data, version 5 indexed
+ * directories, version 6 two-level directory indexes and version 7
+ * variable-length directory records (DirRecord). init_fs() accepts images
+ * from FS_MIN_VERSION to FS_VERSION and rejects anything else.
  */
-#define INODE_START 2
+#define FS_VERSION 7
 
 /**
- * @brief Total number of inodes in the file system.
+ * @brief Oldest on-disk format version init_fs() accepts.
+ *
+ * Directory blocks written before version 7 hold fixed-size records, so
+ * older images must be reformatted.
  */
-#define INODE_COUNT 128
+#define FS_MIN_VERSION 7
 
 /**
- * @brief Starting block index for data blocks.
+ * @brief Inode flag: the block pointers hold extents instead of block numbers.
  */
-#define DATA_START (INODE_START + INODE_BLOCKS)
+#define INODE_FLAG_EXTENTS 0x01
 
 /**
- * @brief Magic number used to identify the file system.
+ * @brief Inode flag: the file contents are stored in the inode itself.
  */
-#define MAGIC_NUMBER 0xf00dbeef
+#define INODE_FLAG_INLINE 0x02
 
 /**
- * @brief Block index for the bitmap used to track free/used blocks.
+ * @brief Inode flag: the directory is indexed by name hash (see DirIndex).
  */
-#define BITMAP_BLOCK 1
+#define INODE_FLAG_INDEXED 0x04
+
+/**
+ * @brief Inode flag: the root of the directory index points at further index
+ * blocks rather than at leaves.
+ */
+#define INODE_FLAG_INDEX2 0x08
+
+/**
+ * @brief Largest file stored inline; the data takes the place of all block pointers.
+ */
+#define INODE_INLINE_SIZE ((MAX_DIRECT_POINTERS + 2) * sizeof(uint32_t))
 
 /**
- * @brief Starting block index for data blocks.
+ * @brief Number of extents stored in the inode itself, in place of direct_blocks.
  */
-#define DATA_BLOCK_START 11
+#define INODE_INLINE_EXTENTS (MAX_DIRECT_POINTERS / 2)
 
 /**
- * @brief Total number of data blocks available in the file system.
+ * @brief Inode number of the root directory.
  */
-#define DATA_BLOCK_COUNT (BLOCK_COUNT - DATA_BLOCK_START)
+#define ROOT_INODE 0
+
+/**
+ * @brief Inode number that marks the end of the free inode list.
+ */
+#define NO_INODE 0xffffffffu
+
+/**
+ * @brief Block index of the first bitmap block used to track free/used blocks.
+ *
+ * The bitmap continues up to the block before the inode table.
+ */
+#define BITMAP_BLOCK 1
 
 /**
  * @brief Maximum number of direct block pointers in an inode.
@@ -72,12 +109,20 @@
 /**
  * @brief Maximum length of a filename (excluding null terminator).
  */
-#define MAX_FILENAME_LEN 27
+#define MAX_FILENAME_LEN 255
+
+/**
+ * @brief Maximum number of files open through open_fs at the same time.
+ */
+#define MAX_OPEN_FILES 16
 
 /**
  * @struct DirectoryEntry
  * @brief Represents a directory entry in the file system.
  *
+ * This is the in-memory form returned by find_dir_entry() and ls_fs(); on
+ * disk, entries are stored as DirRecord records.
+ *
  * @param inum Inode number associated with the directory entry.
  * @param name Name of the file or directory (null-terminated string).
  */
@@ -86,6 +131,29 @@ typedef struct {
     char name[MAX_FILENAME_LEN + 1];  // +1 for null terminator
 } DirectoryEntry;
 
+/**
+ * @struct DirRecord
+ * @brief On-disk directory entry.
+ *
+ * Directory blocks hold these back to back. Each record takes
+ * sizeof(DirRecord) plus its name, rounded up to 4 bytes; rec_len may be
+ * larger, the rest being free space, and the last record of a block runs
+ * to its end. A record with inum 0 is unused.
+ *
+ * @param inum Inode number of the entry, or 0 if the record is unused.
+ * @param rec_len Bytes from this record to the next one.
+ * @param name_len Length of the name.
+ * @param reserved Always 0.
+ * @param name Name of the entry, not null-terminated.
+ */
+typedef struct {
+    uint32_t inum;
+    uint16_t rec_len;
+    uint8_t name_len;
+    uint8_t reserved;
+    char name[];
+} DirRecord;
+
 /**
  * @struct SuperBlock
  * @brief Represents the superblock of the file system.
@@ -93,9 +161,12 @@ typedef struct {
  * @param magic Magic number identifying the file system.
  * @param block_size Size of each block in bytes.
  * @param fs_size_blocks Total size of the file system in blocks.
- * @param inode_start Starting block index for inodes.
+ * @param inode_start Starting block index for inodes; the bitmap fills the blocks before it.
  * @param inode_count Total number of inodes in the file system.
  * @param data_start Starting block index for data blocks.
+ * @param version On-disk format version (FS_VERSION).
+ * @param free_inode_head First inode of the free inode list, or NO_INODE.
+ * @param free_inode_count Number of inodes on the free inode list.
  */
 typedef struct {
     uint32_t magic;
@@ -104,23 +175,81 @@ typedef struct {
     uint32_t inode_start;
     uint32_t inode_count;
     uint32_t data_start;
+    uint32_t version;
+    uint32_t free_inode_head;
+    uint32_t free_inode_count;
 } SuperBlock;
 
+/**
+ * @struct Extent
+ * @brief A run of consecutive data blocks.
+ *
+ * @param start First block of the run.
+ * @param length Number of blocks in the run; 0 marks the end of an extent list.
+ */
+typedef struct {
+    uint32_t start;
+    uint32_t length;
+} Extent;
+
+/**
+ * @struct DirIndexEntry
+ * @brief One entry of a directory index.
+ *
+ * @param hash Lowest name hash stored under this entry.
+ * @param block Physical block of the leaf (DirRecord records) or lower index block.
+ */
+typedef struct {
+    uint32_t hash;
+    uint32_t block;
+} DirIndexEntry;
+
+/**
+ * @struct DirIndex
+ * @brief Index block of an indexed directory.
+ *
+ * The root index is logical block 0. Its entries name leaf blocks or, with
+ * INODE_FLAG_INDEX2 set, a second level of index blocks that name the leaves.
+ * The entries are sorted by hash; a name belongs under the last entry whose
+ * hash is not greater than the name's. The first entry's hash is 0.
+ *
+ * @param count Number of entries in use.
+ * @param blocks In the root, the number of blocks the directory maps, the
+ *        root included; 0 in lower index blocks.
+ * @param entries Index entries, as many as fit in the rest of the block.
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t blocks;
+    DirIndexEntry entries[];
+} DirIndex;
+
 /**
  * @struct Inode
  * @brief Represents an inode in the file system.
  *
+ * With INODE_FLAG_EXTENTS set, direct_blocks holds INODE_INLINE_EXTENTS
+ * (start, length) pairs and indirect_block names a block of further extents.
+ * With INODE_FLAG_INLINE set, the bytes of direct_blocks, indirect_block and
+ * double_indirect_block hold the file contents (up to INODE_INLINE_SIZE bytes).
+ *
  * @param size Size of the file or directory in bytes.
  * @param direct_blocks Array of direct block pointers.
+ * @param indirect_block Block holding the pointers for the blocks after the direct ones, or 0.
+ * @param double_indirect_block Block holding pointers to further indirect blocks, or 0.
  * @param is_valid Indicates whether the inode is valid (1 for valid, 0 for invalid).
  * @param is_directory Indicates whether the inode represents a directory (1 for directory, 0 for file).
+ * @param flags INODE_FLAG_* bits describing how the inode maps its data.
  * @param owner_id ID of the owner of the inode.
  */
 typedef struct {
     uint32_t size;
     uint32_t direct_blocks[MAX_DIRECT_POINTERS];
+    uint32_t indirect_block;
+    uint32_t double_indirect_block;
     uint8_t  is_valid;
     uint8_t  is_directory;
+    uint8_t  flags;
     int owner_id;
 } Inode;
 
@@ -129,10 +258,15 @@ typedef struct {
 /**
  * @brief Creates a new file system on the specified path.
  *
+ * The layout (inode count, inode table size, first data block) is derived
+ * from the geometry and recorded in the superblock, which init_fs() reads back.
+ *
  * @param path Path to the file system image.
+ * @param block_size Block size in bytes (power of two, MIN_BLOCK_SIZE to MAX_BLOCK_SIZE).
+ * @param block_count Total size of the file system in blocks.
  * @return 0 on success, -1 on failure.
  */
-int mkfs_fs(const char *path);
+int mkfs_fs(const char *path, uint32_t block_size, uint32_t block_count);
 
 // File system initialization and cleanup
 
@@ -144,8 +278,28 @@ int mkfs_fs(const char *path);
  */
 int init_fs(const char* disk_path);
 
+/**
+ * @brief Initializes the file system using a specific disk backend.
+ *
+ * @param disk_path Path to the disk image.
+ * @param disk_backend One of the DISK_BACKEND_* constants from disk.h.
+ * @return 0 on success, -1 on failure.
+ */
+int init_fs_ex(const char* disk_path, int disk_backend);
+
+/**
+ * @brief Writes all pending metadata and forces the disk image onto stable storage.
+ *
+ * Block allocation changes are kept in memory until this call or cleanup_fs().
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int sync_fs();
+
 /**
  * @brief Cleans up resources used by the file system.
+ *
+ * Pending metadata is written back before the disk is closed.
  */
 void cleanup_fs();
 
@@ -157,7 +311,7 @@ void cleanup_fs();
 void load_bitmap();
 
 /**
- * @brief Saves the block allocation bitmap to disk.
+ * @brief Saves the block allocation bitmap to disk if it has unsaved changes.
  */
 void save_bitmap();
 
@@ -168,6 +322,19 @@ void save_bitmap();
  */
 int allocate_block();
 
+/**
+ * @brief Allocates several data blocks at once.
+ *
+ * The blocks form one contiguous run when the bitmap has one long enough;
+ * otherwise they are taken from as few runs as possible, longest first. The
+ * block numbers are stored in ascending order within each run.
+ *
+ * @param count Number of blocks to allocate.
+ * @param blocks Array of at least count entries receiving the block numbers.
+ * @return 0 on success, -1 if fewer than count blocks are free (nothing is allocated).
+ */
+int allocate_blocks(uint32_t count, uint32_t *blocks);
+
 /**
  * @brief Frees the specified block, marking it as available.
  *
@@ -202,6 +369,8 @@ void mark_block_free(int block_num);
 /**
  * @brief Reads an inode from the inode table.
  *
+ * The inode table is held in memory from init_fs() on, so this does no disk I/O.
+ *
  * @param inode_num Inode number to read.
  * @param inode Pointer to the inode structure to populate.
  * @return 0 on success, -1 on failure.
@@ -211,6 +380,9 @@ int read_inode(int inode_num, Inode *inode);
 /**
  * @brief Writes an inode to the inode table.
  *
+ * Only the in-memory table is updated; changed inode table blocks are written
+ * back together by sync_fs() or cleanup_fs().
+ *
  * @param inode_num Inode number to write.
  * @param inode Pointer to the inode structure to write.
  * @return 0 on success, -1 on failure.
@@ -220,6 +392,9 @@ int write_inode(int inode_num, Inode *inode);
 /**
  * @brief Allocates a new inode and returns its inode number.
  *
+ * Takes the first inode off the free inode list in constant time. The inode
+ * is returned zeroed and marked valid.
+ *
  * @return Inode number on success, -1 on failure.
  */
 int allocate_inode();
@@ -227,6 +402,9 @@ int allocate_inode();
 /**
  * @brief Frees the specified inode, marking it as available.
  *
+ * The inode is pushed onto the free inode list in constant time. Freeing an
+ * inode that is already free, or the root, does nothing.
+ *
  * @param inode_num Inode number to free.
  */
 void free_inode(int inode_num);
@@ -286,6 +464,11 @@ int create_fs(const char *path);
 /**
  * @brief Writes data to a file at the specified path.
  *
+ * Replaces the previous contents. Data of up to INODE_INLINE_SIZE bytes is
+ * stored in the inode and needs no data block. The new blocks are recorded as extents when
+ * they form few enough runs; otherwise files beyond MAX_DIRECT_POINTERS blocks
+ * are mapped through the single- and double-indirect blocks.
+ *
  * @param path Path to the file.
  * @param data Pointer to the data to write.
  * @param size Size of the data to write in bytes.
@@ -303,6 +486,104 @@ int write_fs(const char *path, const void *data, size_t size);
  */
 int read_fs(const char *path, void *buffer, size_t size);
 
+/**
+ * @brief Reads part of a file, starting at a byte offset.
+ *
+ * Only the blocks covering the range are read.
+ *
+ * @param path Path to the file.
+ * @param buffer Pointer to the buffer to store the read data.
+ * @param size Number of bytes to read.
+ * @param offset Byte offset in the file to start reading from.
+ * @return Number of bytes read (0 at or past the end of the file), -1 on failure.
+ */
+int pread_fs(const char *path, void *buffer, size_t size, size_t offset);
+
+/**
+ * @brief Writes part of a file, starting at a byte offset.
+ *
+ * Only the blocks covering the range are written; a partial block at either
+ * end of the range is read, patched and written back. Writing past the end of
+ * the file grows it, and any gap reads back as zeros.
+ *
+ * @param path Path to the file.
+ * @param data Pointer to the data to write.
+ * @param size Number of bytes to write.
+ * @param offset Byte offset in the file to start writing at.
+ * @return Number of bytes written on success, -1 on failure.
+ */
+int pwrite_fs(const char *path, const void *data, size_t size, size_t offset);
+
+/**
+ * @brief Appends data to the end of a file.
+ *
+ * Only the file's last partial block and the blocks allocated for the new
+ * data are written, so the cost depends on the bytes appended rather than
+ * on the file size.
+ *
+ * @param path Path to the file.
+ * @param data Pointer to the data to append.
+ * @param size Number of bytes to append.
+ * @return Number of bytes written on success, -1 on failure.
+ */
+int append_fs(const char *path, const void *data, size_t size);
+
+/**
+ * @brief Opens a file for handle-based I/O.
+ *
+ * The handle caches the file's inode number and inode, so reads, writes and
+ * seeks on it skip path resolution. Writes through any path or handle keep
+ * the cached inodes current; deleting the file invalidates its handles.
+ * Handles are closed when the filesystem is cleaned up.
+ *
+ * @param path Path to the file.
+ * @return A handle from 0 to MAX_OPEN_FILES - 1 on success, -1 on failure.
+ */
+int open_fs(const char *path);
+
+/**
+ * @brief Closes a handle returned by open_fs.
+ *
+ * @param fd The handle to close.
+ * @return 0 on success, -1 if the handle is not open.
+ */
+int close_fs(int fd);
+
+/**
+ * @brief Reads from an open file at its current offset and advances the offset.
+ *
+ * @param fd Handle returned by open_fs.
+ * @param buffer Pointer to the buffer to store the read data.
+ * @param size Number of bytes to read.
+ * @return Number of bytes read (0 at end of file), -1 on failure.
+ */
+int fread_fs(int fd, void *buffer, size_t size);
+
+/**
+ * @brief Writes to an open file at its current offset and advances the offset.
+ *
+ * Behaves like pwrite_fs at the current offset.
+ *
+ * @param fd Handle returned by open_fs.
+ * @param data Pointer to the data to write.
+ * @param size Number of bytes to write.
+ * @return Number of bytes written on success, -1 on failure.
+ */
+int fwrite_fs(int fd, const void *data, size_t size);
+
+/**
+ * @brief Moves the offset of an open file.
+ *
+ * The offset may be placed past the end of the file; a later write there
+ * fills the gap with zeros.
+ *
+ * @param fd Handle returned by open_fs.
+ * @param offset Offset relative to whence.
+ * @param whence SEEK_SET, SEEK_CUR or SEEK_END.
+ * @return The new offset from the start of the file, -1 on failure.
+ */
+long seek_fs(int fd, long offset, int whence);
+
 /**
  * @brief Deletes a file at the specified path.
  *
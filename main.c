@@ -4,26 +4,46 @@
 #include <string.h>
 #include <stdlib.h>
 
+// Largest file content read_fs prints, in bytes
+#define READ_BUFFER_SIZE (1 << 20)
+
 // Prints usage instructions for the program, including available commands and their arguments.
 void print_usage(const char *program_name) {
     printf("Usage: %s <command> [arguments]\n", program_name);
     printf("Commands:\n");
-    printf("  mkfs                     - Format the disk\n");
+    printf("  mkfs [blocks] [block_size] - Format the disk (default %d blocks of %d bytes)\n",
+           DEFAULT_BLOCK_COUNT, DEFAULT_BLOCK_SIZE);
     printf("  mkdir_fs <path>          - Create a directory\n");
     printf("  create_fs <path>         - Create a file\n");
     printf("  write_fs <path> <data>   - Write data to a file\n");
+    printf("  append_fs <path> <data>  - Append data to a file\n");
     printf("  read_fs <path>           - Read data from a file\n");
+    printf("  pwrite_fs <path> <offset> <data> - Write data at a byte offset of a file\n");
+    printf("  pread_fs <path> <offset> <size>  - Read up to size bytes at a byte offset\n");
     printf("  ls_fs <path>             - List directory contents\n");
     printf("  delete_fs <path>         - Delete a file\n");
     printf("  rmdir_fs <path>          - Remove a directory\n");
 }
 
+// Returns the disk backend named by the MINIFS_BACKEND environment variable
+// ("stdio", "mmap", "pread", "uring", or "direct" and "uring-direct" for the
+// O_DIRECT variants of the last two). Defaults to the stdio backend.
+int disk_backend_from_env() {
+    const char *name = getenv("MINIFS_BACKEND");
+    if (name && strcmp(name, "mmap") == 0) return DISK_BACKEND_MMAP;
+    if (name && strcmp(name, "pread") == 0) return DISK_BACKEND_PREAD;
+    if (name && strcmp(name, "uring") == 0) return DISK_BACKEND_URING;
+    if (name && strcmp(name, "direct") == 0) return DISK_BACKEND_PREAD | DISK_OPEN_DIRECT;
+    if (name && strcmp(name, "uring-direct") == 0) return DISK_BACKEND_URING | DISK_OPEN_DIRECT;
+    return DISK_BACKEND_STDIO;
+}
+
 // Command to format the disk and initialize the filesystem.
-int cmd_mkfs() {
+int cmd_mkfs(uint32_t block_count, uint32_t block_size) {
     const char *disk_name = "disk.img"; // Name of the disk image file.
     
     // Calls the filesystem formatting function and checks for success.
-    if (mkfs_fs(disk_name) != 0) {
+    if (mkfs_fs(disk_name, block_size, block_count) != 0) {
         printf("Failed to format disk.\n");
         return 1; // Return error code if formatting fails.
     }
@@ -36,7 +56,7 @@ int cmd_mkdir_fs(const char *path) {
     const char *disk_name = "disk.img"; // Name of the disk image file.
     
     // Initializes the filesystem before performing operations.
-    if (init_fs(disk_name) != 0) {
+    if (init_fs_ex(disk_name, disk_backend_from_env()) != 0) {
         printf("Failed to initialize filesystem. Run 'mkfs' first.\n");
         return 1; // Return error code if initialization fails.
     }
@@ -59,7 +79,7 @@ int cmd_create_fs(const char *path) {
     const char *disk_name = "disk.img"; // Name of the disk image file.
     
     // Initializes the filesystem before performing operations.
-    if (init_fs(disk_name) != 0) {
+    if (init_fs_ex(disk_name, disk_backend_from_env()) != 0) {
         printf("Failed to initialize filesystem. Run 'mkfs' first.\n");
         return 1; // Return error code if initialization fails.
     }
@@ -82,7 +102,7 @@ int cmd_write_fs(const char *path, const char *data) {
     const char *disk_name = "disk.img"; // Name of the disk image file.
     
     // Initializes the filesystem before performing operations.
-    if (init_fs(disk_name) != 0) {
+    if (init_fs_ex(disk_name, disk_backend_from_env()) != 0) {
         printf("Failed to initialize filesystem. Run 'mkfs' first.\n");
         return 1; // Return error code if initialization fails.
     }
@@ -100,20 +120,43 @@ int cmd_write_fs(const char *path, const char *data) {
     return result; // Return the result of the operation.
 }
 
+// Command to append data to the end of a file in the filesystem.
+int cmd_append_fs(const char *path, const char *data) {
+    const char *disk_name = "disk.img"; // Name of the disk image file.
+    
+    // Initializes the filesystem before performing operations.
+    if (init_fs_ex(disk_name, disk_backend_from_env()) != 0) {
+        printf("Failed to initialize filesystem. Run 'mkfs' first.\n");
+        return 1; // Return error code if initialization fails.
+    }
+    
+    int result = 0; // Variable to store the result of the operation.
+    // Calls the file appending function and checks for success.
+    if (append_fs(path, data, strlen(data)) >= 0) {
+        printf("Appended content to %s.\n", path);
+    } else {
+        printf("Failed to append to file %s.\n", path);
+        result = 1; // Update result to indicate failure.
+    }
+    
+    cleanup_fs(); // Cleans up resources after the operation.
+    return result; // Return the result of the operation.
+}
+
 // Command to read data from a file in the filesystem.
 int cmd_read_fs(const char *path) {
     const char *disk_name = "disk.img"; // Name of the disk image file.
-    char read_buffer[1024] = {0}; // Buffer to store the read data.
+    static char read_buffer[READ_BUFFER_SIZE]; // Buffer to store the read data.
     
     // Initializes the filesystem before performing operations.
-    if (init_fs(disk_name) != 0) {
+    if (init_fs_ex(disk_name, disk_backend_from_env()) != 0) {
         printf("Failed to initialize filesystem. Run 'mkfs' first.\n");
         return 1; // Return error code if initialization fails.
     }
     
     int result = 0; // Variable to store the result of the operation.
     // Calls the file reading function and checks for success.
-    int bytes_read = read_fs(path, read_buffer, sizeof(read_buffer));
+    int bytes_read = read_fs(path, read_buffer, sizeof(read_buffer) - 1); // Room for the terminator
     if (bytes_read >= 0) {
         read_buffer[bytes_read] = '\0'; // Null-terminate the read data.
         printf("Read %d bytes from %s: \"%s\"\n", bytes_read, path, read_buffer);
@@ -126,13 +169,68 @@ int cmd_read_fs(const char *path) {
     return result; // Return the result of the operation.
 }
 
+// Command to write data at a byte offset of a file in the filesystem.
+int cmd_pwrite_fs(const char *path, size_t offset, const char *data) {
+    const char *disk_name = "disk.img"; // Name of the disk image file.
+    
+    // Initializes the filesystem before performing operations.
+    if (init_fs_ex(disk_name, disk_backend_from_env()) != 0) {
+        printf("Failed to initialize filesystem. Run 'mkfs' first.\n");
+        return 1; // Return error code if initialization fails.
+    }
+    
+    int result = 0; // Variable to store the result of the operation.
+    // Calls the positional write function and checks for success.
+    if (pwrite_fs(path, data, strlen(data), offset) >= 0) {
+        printf("Wrote content to %s at offset %lu.\n", path, (unsigned long)offset);
+    } else {
+        printf("Failed to write to file %s.\n", path);
+        result = 1; // Update result to indicate failure.
+    }
+    
+    cleanup_fs(); // Cleans up resources after the operation.
+    return result; // Return the result of the operation.
+}
+
+// Command to read bytes at a byte offset of a file in the filesystem. Zero
+// bytes, as read back from holes, are shown as \0.
+int cmd_pread_fs(const char *path, size_t offset, size_t size) {
+    const char *disk_name = "disk.img"; // Name of the disk image file.
+    static char read_buffer[READ_BUFFER_SIZE]; // Buffer to store the read data.
+    
+    // Initializes the filesystem before performing operations.
+    if (init_fs_ex(disk_name, disk_backend_from_env()) != 0) {
+        printf("Failed to initialize filesystem. Run 'mkfs' first.\n");
+        return 1; // Return error code if initialization fails.
+    }
+    
+    int result = 0; // Variable to store the result of the operation.
+    if (size > sizeof(read_buffer)) size = sizeof(read_buffer);
+    // Calls the positional read function and checks for success.
+    int bytes_read = pread_fs(path, read_buffer, size, offset);
+    if (bytes_read >= 0) {
+        printf("Read %d bytes from %s at offset %lu: \"", bytes_read, path, (unsigned long)offset);
+        for (int i = 0; i < bytes_read; i++) {
+            if (read_buffer[i] == '\0') printf("\\0");
+            else putchar(read_buffer[i]);
+        }
+        printf("\"\n");
+    } else {
+        printf("Failed to read from file %s.\n", path);
+        result = 1; // Update result to indicate failure.
+    }
+    
+    cleanup_fs(); // Cleans up resources after the operation.
+    return result; // Return the result of the operation.
+}
+
 // Command to list the contents of a directory in the filesystem.
 int cmd_ls_fs(const char *path) {
     const char *disk_name = "disk.img"; // Name of the disk image file.
     DirectoryEntry entries[10]; // Array to store directory entries.
     
     // Initializes the filesystem before performing operations.
-    if (init_fs(disk_name) != 0) {
+    if (init_fs_ex(disk_name, disk_backend_from_env()) != 0) {
         printf("Failed to initialize filesystem. Run 'mkfs' first.\n");
         return 1; // Return error code if initialization fails.
     }
@@ -159,7 +257,7 @@ int cmd_delete_fs(const char *path) {
     const char *disk_name = "disk.img"; // Name of the disk image file.
     
     // Initializes the filesystem before performing operations.
-    if (init_fs(disk_name) != 0) {
+    if (init_fs_ex(disk_name, disk_backend_from_env()) != 0) {
         printf("Failed to initialize filesystem. Run 'mkfs' first.\n");
         return 1; // Return error code if initialization fails.
     }
@@ -182,7 +280,7 @@ int cmd_rmdir_fs(const char *path) {
     const char *disk_name = "disk.img"; // Name of the disk image file.
     
     // Initializes the filesystem before performing operations.
-    if (init_fs(disk_name) != 0) {
+    if (init_fs_ex(disk_name, disk_backend_from_env()) != 0) {
         printf("Failed to initialize filesystem. Run 'mkfs' first.\n");
         return 1; // Return error code if initialization fails.
     }
@@ -211,7 +309,13 @@ int main(int argc, char *argv[]) {
     
     // Match the command string and execute the corresponding function.
     if (strcmp(command, "mkfs") == 0) {
-        return cmd_mkfs();
+        if (argc > 4) {
+            printf("Usage: %s mkfs [blocks] [block_size]\n", argv[0]);
+            return 1; // Return error code if there are too many arguments.
+        }
+        uint32_t block_count = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : DEFAULT_BLOCK_COUNT;
+        uint32_t block_size = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 10) : DEFAULT_BLOCK_SIZE;
+        return cmd_mkfs(block_count, block_size);
     }
     else if (strcmp(command, "mkdir_fs") == 0) {
         if (argc != 3) {
@@ -234,6 +338,13 @@ int main(int argc, char *argv[]) {
         }
         return cmd_write_fs(argv[2], argv[3]);
     }
+    else if (strcmp(command, "append_fs") == 0) {
+        if (argc != 4) {
+            printf("Usage: %s append_fs <path> <data>\n", argv[0]);
+            return 1; // Return error code if arguments are missing.
+        }
+        return cmd_append_fs(argv[2], argv[3]);
+    }
     else if (strcmp(command, "read_fs") == 0) {
         if (argc != 3) {
             printf("Usage: %s read_fs <path>\n", argv[0]);
@@ -241,6 +352,20 @@ int main(int argc, char *argv[]) {
         }
         return cmd_read_fs(argv[2]);
     }
+    else if (strcmp(command, "pwrite_fs") == 0) {
+        if (argc != 5) {
+            printf("Usage: %s pwrite_fs <path> <offset> <data>\n", argv[0]);
+            return 1; // Return error code if arguments are missing.
+        }
+        return cmd_pwrite_fs(argv[2], (size_t)strtoul(argv[3], NULL, 10), argv[4]);
+    }
+    else if (strcmp(command, "pread_fs") == 0) {
+        if (argc != 5) {
+            printf("Usage: %s pread_fs <path> <offset> <size>\n", argv[0]);
+            return 1; // Return error code if arguments are missing.
+        }
+        return cmd_pread_fs(argv[2], (size_t)strtoul(argv[3], NULL, 10), (size_t)strtoul(argv[4], NULL, 10));
+    }
     else if (strcmp(command, "ls_fs") == 0) {
         if (argc != 3) {
             printf("Usage: %s ls_fs <path>\n", argv[0]);
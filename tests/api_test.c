@@ -0,0 +1,208 @@
+// Checks the library calls that the command line cannot reach in one process:
+// offset I/O with holes and file handles, including handles on a deleted file,
+// and directories large enough to need an index of two levels.
+// Uses the disk backend named by MINIFS_BACKEND, like mini_fs.
+#include "fs.h"
+#include "disk.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define TEST_IMAGE "tests/api_test.img"
+
+static int failures = 0;
+
+// Reports a failed check without stopping the run
+static void check(int ok, const char *what) {
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+// Same mapping as mini_fs
+static int disk_backend_from_env() {
+    const char *name = getenv("MINIFS_BACKEND");
+    if (name && strcmp(name, "mmap") == 0) return DISK_BACKEND_MMAP;
+    if (name && strcmp(name, "pread") == 0) return DISK_BACKEND_PREAD;
+    if (name && strcmp(name, "uring") == 0) return DISK_BACKEND_URING;
+    if (name && strcmp(name, "direct") == 0) return DISK_BACKEND_PREAD | DISK_OPEN_DIRECT;
+    if (name && strcmp(name, "uring-direct") == 0) return DISK_BACKEND_URING | DISK_OPEN_DIRECT;
+    return DISK_BACKEND_STDIO;
+}
+
+// Offsets, holes and growth through pwrite_fs/pread_fs
+static void test_offsets() {
+    char buf[4096];
+    check(create_fs("/sparse") == 0, "create /sparse");
+    check(pwrite_fs("/sparse", "head", 4, 0) == 4, "pwrite at 0");
+    check(pwrite_fs("/sparse", "tail", 4, 3000) == 4, "pwrite past end leaves a hole");
+
+    check(pread_fs("/sparse", buf, sizeof(buf), 0) == 3004, "pread stops at end of file");
+    int hole_is_zero = 1;
+    for (int i = 4; i < 3000; i++) hole_is_zero &= buf[i] == 0;
+    check(hole_is_zero, "hole reads back as zeros");
+    check(memcmp(buf, "head", 4) == 0 && memcmp(buf + 3000, "tail", 4) == 0, "data around the hole");
+
+    check(pwrite_fs("/sparse", "XY", 2, 1023) == 2, "pwrite across a block boundary");
+    check(pread_fs("/sparse", buf, 4, 1022) == 4 && memcmp(buf, "\0XY\0", 4) == 0, "pread across a block boundary");
+    check(pread_fs("/sparse", buf, 4, 3004) == 0, "pread at end of file");
+    check(delete_fs("/sparse") == 0, "delete /sparse");
+}
+
+// Whole-file writes must not touch directory contents
+static void test_write_directory() {
+    check(mkdir_fs("/d") == 0 && create_fs("/d/child") == 0, "set up /d");
+    check(write_fs("/d", "tiny", 4) < 0, "small write_fs on a directory fails");
+    check(write_fs("/d", "x", 0) < 0, "empty write_fs on a directory fails");
+    int inum;
+    check(path_to_inode("/d/child", &inum, 0) == 0, "child survives");
+    check(delete_fs("/d/child") == 0 && rmdir_fs("/d") == 0, "remove /d");
+}
+
+// Handle reads, writes and seeks, and what a handle sees of other writers
+static void test_handles() {
+    char buf[64];
+    check(create_fs("/h") == 0, "create /h");
+    int fd = open_fs("/h");
+    check(fd >= 0, "open /h");
+
+    check(fwrite_fs(fd, "abcdef", 6) == 6, "fwrite");
+    check(seek_fs(fd, 2, SEEK_SET) == 2, "seek from start");
+    check(fread_fs(fd, buf, 3) == 3 && memcmp(buf, "cde", 3) == 0, "fread after seek");
+    check(seek_fs(fd, -1, SEEK_END) == 5, "seek from end");
+    check(fwrite_fs(fd, "XYZ", 3) == 3, "fwrite over the end");
+    check(read_fs("/h", buf, sizeof(buf)) == 8 && memcmp(buf, "abcdeXYZ", 8) == 0, "fwrite seen by path");
+
+    check(seek_fs(fd, 100, SEEK_SET) == 100 && fwrite_fs(fd, "!", 1) == 1, "fwrite past end");
+    check(seek_fs(fd, 6, SEEK_SET) == 6 && fread_fs(fd, buf, 4) == 4 && memcmp(buf, "YZ\0\0", 4) == 0,
+          "fread into the hole");
+
+    check(pwrite_fs("/h", "ab", 2, 101) == 2, "pwrite by path");
+    check(seek_fs(fd, 0, SEEK_END) == 103, "handle sees the new size");
+    check(seek_fs(fd, -1, SEEK_SET) < 0, "seek before start fails");
+
+    check(close_fs(fd) == 0, "close");
+    check(close_fs(fd) < 0, "second close fails");
+    check(fread_fs(fd, buf, 1) < 0, "fread on a closed handle fails");
+    check(delete_fs("/h") == 0, "delete /h");
+}
+
+// A handle on a deleted file goes stale, even once its inode is reused
+static void test_handle_after_delete() {
+    char buf[16];
+    check(create_fs("/gone") == 0, "create /gone");
+    check(write_fs("/gone", "old data", 8) == 8, "write /gone");
+    int fd = open_fs("/gone");
+    check(fd >= 0, "open /gone");
+    check(delete_fs("/gone") == 0, "delete open file");
+
+    check(create_fs("/new") == 0 && write_fs("/new", "new data", 8) == 8, "create a file in its place");
+    check(fread_fs(fd, buf, sizeof(buf)) < 0, "fread on a deleted file fails");
+    check(fwrite_fs(fd, "x", 1) < 0, "fwrite on a deleted file fails");
+    check(read_fs("/new", buf, sizeof(buf)) == 8 && memcmp(buf, "new data", 8) == 0, "new file untouched");
+    check(delete_fs("/new") == 0, "delete /new");
+}
+
+// The handle table is bounded by MAX_OPEN_FILES
+static void test_handle_limit() {
+    int fds[MAX_OPEN_FILES];
+    check(create_fs("/many") == 0, "create /many");
+    for (int i = 0; i < MAX_OPEN_FILES; i++) fds[i] = open_fs("/many");
+    check(fds[MAX_OPEN_FILES - 1] >= 0, "open MAX_OPEN_FILES handles");
+    check(open_fs("/many") < 0, "one more open fails");
+    for (int i = 0; i < MAX_OPEN_FILES; i++) close_fs(fds[i]);
+    check(delete_fs("/many") == 0, "delete /many");
+}
+
+// Name of entry i of the large directory test, long enough that a 512-byte
+// block holds only two of them
+static void big_name(char *path, int i) {
+    sprintf(path, "/big/%04d_", i);
+    memset(path + 10, 'n', 190);
+    path[200] = '\0';
+}
+
+// Fills a directory past one block (conversion to an index, leaf splits) and
+// past one index block (second index level), then looks up, lists and removes
+// the entries, across a remount
+static void test_large_directory() {
+    enum { ENTRIES = 400 };
+    char path[256];
+    static DirectoryEntry entries[ENTRIES + 1];
+    Inode dir;
+    int dir_inum, inum;
+
+    cleanup_fs();
+    if (mkfs_fs(TEST_IMAGE, 512, 8192) != 0 || init_fs_ex(TEST_IMAGE, disk_backend_from_env()) != 0) {
+        check(0, "set up the large directory image");
+        return;
+    }
+    check(mkdir_fs("/big") == 0, "mkdir /big");
+    int created = 0;
+    for (int i = 0; i < ENTRIES; i++) {
+        big_name(path, i);
+        created += (i % 5 == 0 ? mkdir_fs(path) : create_fs(path)) == 0;
+    }
+    check(created == ENTRIES, "create every entry");
+    big_name(path, 7);
+    check(create_fs(path) < 0, "duplicate name is rejected");
+
+    check(path_to_inode("/big", &dir_inum, 0) == 0 && read_inode(dir_inum, &dir) == 0, "read /big");
+    check((dir.flags & INODE_FLAG_INDEXED) != 0, "directory is indexed");
+    check((dir.flags & INODE_FLAG_INDEX2) != 0, "directory index has two levels");
+
+    cleanup_fs(); // Lookups below come from disk, not the dentry cache
+    check(init_fs_ex(TEST_IMAGE, disk_backend_from_env()) == 0, "remount");
+    int found = 0;
+    for (int i = 0; i < ENTRIES; i++) {
+        big_name(path, i);
+        found += path_to_inode(path, &inum, 0) == 0;
+    }
+    check(found == ENTRIES, "look up every entry");
+    check(ls_fs("/big", entries, ENTRIES + 1) == ENTRIES, "ls lists every entry");
+
+    for (int i = 0; i < ENTRIES; i += 2) {
+        big_name(path, i);
+        if (i % 5 == 0) rmdir_fs(path);
+        else delete_fs(path);
+    }
+    check(rmdir_fs("/big") < 0, "non-empty directory is kept");
+    check(read_inode(dir_inum, &dir) == 0, "reread /big");
+    int right = 0;
+    for (int i = 0; i < ENTRIES; i++) {
+        big_name(path, i);
+        right += (find_dir_entry(&dir, path + 5, NULL) == 0) == (i % 2 == 1);
+    }
+    check(right == ENTRIES, "only deleted entries are gone");
+    check(ls_fs("/big", entries, ENTRIES + 1) == ENTRIES / 2, "ls after deleting half");
+
+    for (int i = 1; i < ENTRIES; i += 2) {
+        big_name(path, i);
+        if (i % 5 == 0) rmdir_fs(path);
+        else delete_fs(path);
+    }
+    check(ls_fs("/big", entries, ENTRIES + 1) == 0, "ls of the emptied directory");
+    check(rmdir_fs("/big") == 0, "rmdir the emptied directory");
+}
+
+int main() {
+    if (mkfs_fs(TEST_IMAGE, DEFAULT_BLOCK_SIZE, DEFAULT_BLOCK_COUNT) != 0 ||
+        init_fs_ex(TEST_IMAGE, disk_backend_from_env()) != 0) {
+        printf("FAILED: set up %s\n", TEST_IMAGE);
+        return 1;
+    }
+
+    test_offsets();
+    test_write_directory();
+    test_handles();
+    test_handle_after_delete();
+    test_handle_limit();
+    test_large_directory();
+
+    cleanup_fs();
+    remove(TEST_IMAGE);
+    if (failures > 0) return 1;
+    printf("API tests passed.\n");
+    return 0;
+}